@@ -4,7 +4,6 @@
 
 STATIC LIST_ENTRY                  mRecoveries;
 STATIC FSTAB                       *mFstab = NULL;
-STATIC LIST_ENTRY                  mUsedCacheVariables;
 
 // ESP
 STATIC CHAR16                          *mEspPartitionName = NULL;
@@ -21,108 +20,713 @@ STATIC CHAR8       *mInternalROMName = NULL;
 STATIC CONST CHAR8 *mInternalROMIconPath = NULL;
 STATIC CONST CHAR8 *mInternalROMAndroidVersion = NULL;
 
+//
+// ramdisk info cache. all entries live in the single 'RdInfoCache' variable,
+// which gets read once at init and written once after the scan if it changed
+//
+typedef struct {
+  RDINFO_CACHE_ENTRY Entry;
+  // seen during this scan, everything else gets dropped on save
+  BOOLEAN            Used;
+} RDINFO_CACHE_ITEM;
+
+STATIC RDINFO_CACHE_ITEM *mRdInfoCache = NULL;
+STATIC UINTN             mRdInfoCacheCount = 0;
+STATIC UINTN             mRdInfoCacheCapacity = 0;
+STATIC BOOLEAN           mRdInfoCacheDirty = FALSE;
+
 STATIC
-VOID
-AddCacheVariableToList (
-  LIST_ENTRY   *List,
-  CONST CHAR16 *VariableName
-)
+RETURN_STATUS
+EFIAPI
+IterateVariablesCallbackAddToList (
+  IN  VOID                         *Context,
+  IN  CHAR16                       *VariableName,
+  IN  EFI_GUID                     *VendorGuid,
+  IN  UINT32                       Attributes,
+  IN  UINTN                        DataSize,
+  IN  VOID                         *Data
+  )
 {
-  STRING_LIST_ITEM *Item;
+  LIST_ENTRY          *List;
+  STRING_LIST_ITEM    *Item;
 
-  // allocate menu
+  List = Context;
+
+  // skip variables with other GUID's
+  if (!CompareGuid(VendorGuid, &gEFIDroidVariableDataGuid))
+    return EFI_SUCCESS;
+
+  // skip everything but the old per image cache variables
+  if (StrStr(VariableName, L"RdInfoCache-")!=VariableName)
+    return EFI_SUCCESS;
+
+  // add to list
   Item = AllocateZeroPool (sizeof(*Item));
   if(Item==NULL)
-    return;
+    return EFI_SUCCESS;
 
   Item->Signature = STRING_LIST_SIGNATURE;
   Item->VariableName = UnicodeStrDup(VariableName);
-
   InsertTailList (List, &Item->Link);
+
+  return EFI_SUCCESS;
 }
 
+//
+// older versions stored one variable per image, remove them once
+//
 STATIC
-BOOLEAN
-IsCacheVariableInList (
-  CONST CHAR16 *VariableName
+VOID
+RemoveLegacyCacheVariables (
+  VOID
 )
 {
+  LIST_ENTRY VariableRemovalList;
   LIST_ENTRY* Link;
   STRING_LIST_ITEM* Item;
 
-  for (Link = GetFirstNode (&mUsedCacheVariables);
-       !IsNull (&mUsedCacheVariables, Link);
-       Link = GetNextNode (&mUsedCacheVariables, Link)
-      ) {
+  InitializeListHead(&VariableRemovalList);
+
+  // build list of variables to remove
+  UtilIterateVariables(IterateVariablesCallbackAddToList, &VariableRemovalList);
+
+  // remove them
+  while (!IsListEmpty (&VariableRemovalList)) {
+    Link = GetFirstNode (&VariableRemovalList);
     Item = CR (Link, STRING_LIST_ITEM, Link, STRING_LIST_SIGNATURE);
+    RemoveEntryList (Link);
+
+    if (Item->VariableName) {
+      UtilSetEFIDroidDataVariable(Item->VariableName, NULL, 0);
+      FreePool(Item->VariableName);
+    }
+    FreePool(Item);
+  }
+}
+
+STATIC
+EFI_STATUS
+RdInfoCacheReserve (
+  UINTN Count
+)
+{
+  RDINFO_CACHE_ITEM *NewCache;
+  UINTN             NewCapacity;
+
+  if (Count <= mRdInfoCacheCapacity)
+    return EFI_SUCCESS;
+
+  NewCapacity = MAX(Count, mRdInfoCacheCapacity * 2);
+  NewCapacity = MAX(NewCapacity, 16);
+  NewCache = ReallocatePool(mRdInfoCacheCapacity * sizeof(*mRdInfoCache), NewCapacity * sizeof(*mRdInfoCache), mRdInfoCache);
+  if (NewCache == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  mRdInfoCache = NewCache;
+  mRdInfoCacheCapacity = NewCapacity;
+
+  return EFI_SUCCESS;
+}
+
+//
+// reads a cache variable and checks its version and size.
+// the caller frees the returned header, the entries follow it
+//
+STATIC
+EFI_STATUS
+CacheVariableRead (
+  IN  CONST CHAR16          *Name,
+  IN  UINT32                Version,
+  IN  UINTN                 EntrySize,
+  OUT CACHE_VARIABLE_HEADER **HeaderOut
+)
+{
+  EFI_STATUS            Status;
+  UINTN                 Size;
+  CACHE_VARIABLE_HEADER *Header;
+
+  Size = 0;
+  Status = gRT->GetVariable ((CHAR16*)Name, &gEFIDroidVariableDataGuid, NULL, &Size, NULL);
+  if (Status != EFI_BUFFER_TOO_SMALL)
+    return Status==EFI_NOT_FOUND ? EFI_NOT_FOUND : EFI_VOLUME_CORRUPTED;
+
+  Header = AllocatePool(Size);
+  if (Header == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Status = gRT->GetVariable ((CHAR16*)Name, &gEFIDroidVariableDataGuid, NULL, &Size, Header);
+  if (EFI_ERROR (Status))
+    goto INVALID;
+
+  if (Size < sizeof(*Header) || Header->Version != Version)
+    goto INVALID;
+  if (Header->Count != (Size - sizeof(*Header)) / EntrySize || (Size - sizeof(*Header)) % EntrySize)
+    goto INVALID;
+
+  *HeaderOut = Header;
+  return EFI_SUCCESS;
+
+INVALID:
+  FreePool(Header);
+  return EFI_VOLUME_CORRUPTED;
+}
+
+STATIC
+VOID
+RdInfoCacheLoad (
+  VOID
+)
+{
+  EFI_STATUS            Status;
+  UINTN                 Index;
+  CACHE_VARIABLE_HEADER *Header = NULL;
+  RDINFO_CACHE_ENTRY    *Entries;
+
+  Status = CacheVariableRead(L"RdInfoCache", RDINFO_CACHE_VERSION, sizeof(*Entries), &Header);
+  if (Status == EFI_NOT_FOUND) {
+    RemoveLegacyCacheVariables();
+    mRdInfoCacheDirty = TRUE;
+    return;
+  }
+  if (EFI_ERROR (Status))
+    goto INVALID;
+
+  Status = RdInfoCacheReserve(Header->Count);
+  if (EFI_ERROR (Status))
+    goto INVALID;
+
+  Entries = (RDINFO_CACHE_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Header->Count; Index++) {
+    CopyMem(&mRdInfoCache[Index].Entry, &Entries[Index], sizeof(*Entries));
+    mRdInfoCache[Index].Used = FALSE;
+  }
+  mRdInfoCacheCount = Header->Count;
+
+  FreePool(Header);
+  return;
+
+INVALID:
+  // start over, the variable gets replaced on save
+  if (Header)
+    FreePool(Header);
+  mRdInfoCacheCount = 0;
+  mRdInfoCacheDirty = TRUE;
+}
+
+STATIC
+VOID
+RdInfoCacheSave (
+  VOID
+)
+{
+  UINTN                 Index;
+  UINTN                 Count;
+  UINTN                 Size;
+  CACHE_VARIABLE_HEADER *Header;
+  RDINFO_CACHE_ENTRY    *Entries;
+
+  // drop entries of images which weren't found during the scan
+  Count = 0;
+  for (Index = 0; Index < mRdInfoCacheCount; Index++) {
+    if (!mRdInfoCache[Index].Used) {
+      mRdInfoCacheDirty = TRUE;
+      continue;
+    }
+
+    if (Count != Index)
+      CopyMem(&mRdInfoCache[Count], &mRdInfoCache[Index], sizeof(*mRdInfoCache));
+    Count++;
+  }
+  mRdInfoCacheCount = Count;
+
+  if (!mRdInfoCacheDirty)
+    return;
+
+  Size = sizeof(*Header) + Count * sizeof(*Entries);
+  Header = AllocatePool(Size);
+  if (Header == NULL)
+    return;
+
+  Header->Version = RDINFO_CACHE_VERSION;
+  Header->Count = Count;
+  Entries = (RDINFO_CACHE_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Count; Index++) {
+    CopyMem(&Entries[Index], &mRdInfoCache[Index].Entry, sizeof(*Entries));
+  }
+
+  if (!EFI_ERROR (UtilSetEFIDroidDataVariable(L"RdInfoCache", Header, Size)))
+    mRdInfoCacheDirty = FALSE;
+
+  FreePool(Header);
+}
+
+STATIC
+RDINFO_CACHE_ITEM*
+RdInfoCacheFind (
+  UINT32 Checksum,
+  INT32  Id
+)
+{
+  UINTN Index;
+
+  for (Index = 0; Index < mRdInfoCacheCount; Index++) {
+    if (mRdInfoCache[Index].Entry.Checksum == Checksum && mRdInfoCache[Index].Entry.Id == Id)
+      return &mRdInfoCache[Index];
+  }
+
+  return NULL;
+}
+
+STATIC
+VOID
+RdInfoCacheStore (
+  UINT32              Checksum,
+  INT32               Id,
+  CONST IMGINFO_CACHE *Info
+)
+{
+  RDINFO_CACHE_ITEM *Item;
+
+  Item = RdInfoCacheFind(Checksum, Id);
+  if (Item == NULL) {
+    if (EFI_ERROR (RdInfoCacheReserve(mRdInfoCacheCount + 1)))
+      return;
+
+    Item = &mRdInfoCache[mRdInfoCacheCount++];
+    Item->Entry.Checksum = Checksum;
+    Item->Entry.Id = Id;
+  }
+  else if (!CompareMem(&Item->Entry.Info, Info, sizeof(*Info))) {
+    Item->Used = TRUE;
+    return;
+  }
+
+  CopyMem(&Item->Entry.Info, Info, sizeof(*Info));
+  Item->Used = TRUE;
+  mRdInfoCacheDirty = TRUE;
+}
+
+//
+// partitions which turned out not to contain a boot image.
+// they get skipped until their identity changes
+//
+typedef struct {
+  PROBE_CACHE_ENTRY Entry;
+  BOOLEAN           Used;
+} PROBE_CACHE_ITEM;
+
+STATIC PROBE_CACHE_ITEM *mProbeCache = NULL;
+STATIC UINTN            mProbeCacheCount = 0;
+STATIC UINTN            mProbeCacheCapacity = 0;
+STATIC BOOLEAN          mProbeCacheDirty = FALSE;
+
+STATIC
+VOID
+ProbeCacheLoad (
+  VOID
+)
+{
+  EFI_STATUS            Status;
+  UINTN                 Index;
+  CACHE_VARIABLE_HEADER *Header;
+  PROBE_CACHE_ENTRY     *Entries;
+
+  Status = CacheVariableRead(L"ProbeCache", PROBE_CACHE_VERSION, sizeof(*Entries), &Header);
+  if (EFI_ERROR (Status)) {
+    mProbeCacheDirty = (Status != EFI_NOT_FOUND);
+    return;
+  }
+
+  mProbeCache = AllocatePool(Header->Count * sizeof(*mProbeCache));
+  if (mProbeCache == NULL) {
+    FreePool(Header);
+    mProbeCacheDirty = TRUE;
+    return;
+  }
 
-    if (!StrCmp(Item->VariableName, VariableName))
+  Entries = (PROBE_CACHE_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Header->Count; Index++) {
+    CopyMem(&mProbeCache[Index].Entry, &Entries[Index], sizeof(*Entries));
+    mProbeCache[Index].Used = FALSE;
+  }
+  mProbeCacheCount = mProbeCacheCapacity = Header->Count;
+
+  FreePool(Header);
+}
+
+STATIC
+VOID
+ProbeCacheSave (
+  VOID
+)
+{
+  UINTN                 Index;
+  UINTN                 Count;
+  UINTN                 Size;
+  CACHE_VARIABLE_HEADER *Header;
+  PROBE_CACHE_ENTRY     *Entries;
+
+  // drop partitions which weren't seen during the scan
+  Count = 0;
+  for (Index = 0; Index < mProbeCacheCount; Index++) {
+    if (!mProbeCache[Index].Used) {
+      mProbeCacheDirty = TRUE;
+      continue;
+    }
+
+    if (Count != Index)
+      CopyMem(&mProbeCache[Count], &mProbeCache[Index], sizeof(*mProbeCache));
+    Count++;
+  }
+  mProbeCacheCount = Count;
+
+  if (!mProbeCacheDirty)
+    return;
+
+  Size = sizeof(*Header) + Count * sizeof(*Entries);
+  Header = AllocatePool(Size);
+  if (Header == NULL)
+    return;
+
+  Header->Version = PROBE_CACHE_VERSION;
+  Header->Count = Count;
+  Entries = (PROBE_CACHE_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Count; Index++) {
+    CopyMem(&Entries[Index], &mProbeCache[Index].Entry, sizeof(*Entries));
+  }
+
+  if (!EFI_ERROR (UtilSetEFIDroidDataVariable(L"ProbeCache", Header, Size)))
+    mProbeCacheDirty = FALSE;
+
+  FreePool(Header);
+}
+
+//
+// returns the last HD node, that's the partition itself. whole disks don't have one
+//
+STATIC
+HARDDRIVE_DEVICE_PATH*
+GetPartitionNode (
+  IN EFI_DEVICE_PATH_PROTOCOL  *DevicePath
+)
+{
+  EFI_DEVICE_PATH_PROTOCOL *Node;
+  HARDDRIVE_DEVICE_PATH    *Hd = NULL;
+
+  if (DevicePath == NULL)
+    return NULL;
+
+  for (Node = DevicePath; !IsDevicePathEnd (Node); Node = NextDevicePathNode (Node)) {
+    if (DevicePathType (Node) == MEDIA_DEVICE_PATH && DevicePathSubType (Node) == MEDIA_HARDDRIVE_DP)
+      Hd = (HARDDRIVE_DEVICE_PATH*) Node;
+  }
+
+  return Hd;
+}
+
+//
+// a partition is identified by its partition GUID, its size and the crc of its header
+//
+STATIC
+EFI_STATUS
+ProbeCacheGetIdentity (
+  IN  EFI_DEVICE_PATH_PROTOCOL  *DevicePath,
+  IN  EFI_BLOCK_IO_PROTOCOL     *BlockIo,
+  OUT PROBE_CACHE_ENTRY         *Entry
+)
+{
+  HARDDRIVE_DEVICE_PATH    *Hd;
+
+  Hd = GetPartitionNode(DevicePath);
+  if (Hd == NULL)
+    return EFI_NOT_FOUND;
+
+  SetMem(Entry, sizeof(*Entry), 0);
+  switch (Hd->SignatureType) {
+  case SIGNATURE_TYPE_GUID:
+    CopyMem(&Entry->PartitionGuid, Hd->Signature, sizeof(Entry->PartitionGuid));
+    break;
+
+  case SIGNATURE_TYPE_MBR:
+    CopyMem(&Entry->PartitionGuid, Hd->Signature, sizeof(UINT32));
+    Entry->PartitionGuid.Data4[7] = (UINT8)Hd->PartitionNumber;
+    break;
+
+  default:
+    return EFI_UNSUPPORTED;
+  }
+
+  Entry->Size = MultU64x32(BlockIo->Media->LastBlock+1, BlockIo->Media->BlockSize);
+
+  return LoaderGetBlockIoHeaderCrc(BlockIo, &Entry->HeaderCrc);
+}
+
+STATIC
+BOOLEAN
+ProbeCacheContains (
+  IN CONST PROBE_CACHE_ENTRY *Entry
+)
+{
+  UINTN Index;
+
+  for (Index = 0; Index < mProbeCacheCount; Index++) {
+    if (!CompareMem(&mProbeCache[Index].Entry, Entry, sizeof(*Entry))) {
+      mProbeCache[Index].Used = TRUE;
       return TRUE;
+    }
   }
 
   return FALSE;
 }
 
 STATIC
-RETURN_STATUS
-EFIAPI
-IterateVariablesCallbackAddToList (
-  IN  VOID                         *Context,
-  IN  CHAR16                       *VariableName,
-  IN  EFI_GUID                     *VendorGuid,
-  IN  UINT32                       Attributes,
-  IN  UINTN                        DataSize,
-  IN  VOID                         *Data
-  )
+VOID
+ProbeCacheAdd (
+  IN CONST PROBE_CACHE_ENTRY *Entry
+)
 {
-  EFI_STATUS          Status;
-  LIST_ENTRY          *List;
+  PROBE_CACHE_ITEM *NewCache;
+  UINTN            NewCapacity;
 
-  Status = EFI_SUCCESS;
-  List = Context;
+  if (mProbeCacheCount == mProbeCacheCapacity) {
+    NewCapacity = MAX(mProbeCacheCapacity * 2, 16);
+    NewCache = ReallocatePool(mProbeCacheCapacity * sizeof(*mProbeCache), NewCapacity * sizeof(*mProbeCache), mProbeCache);
+    if (NewCache == NULL)
+      return;
 
-  // skip variables with other GUID's
-  if (!CompareGuid(VendorGuid, &gEFIDroidVariableDataGuid))
-    return Status;
+    mProbeCache = NewCache;
+    mProbeCacheCapacity = NewCapacity;
+  }
 
-  // skip non-cache variable
-  if (StrStr(VariableName, L"RdInfoCache")!=VariableName)
-    return Status;
+  CopyMem(&mProbeCache[mProbeCacheCount].Entry, Entry, sizeof(*Entry));
+  mProbeCache[mProbeCacheCount].Used = TRUE;
+  mProbeCacheCount++;
+  mProbeCacheDirty = TRUE;
+}
 
-  // skip variables which are in the global cache list
-  if (IsCacheVariableInList(VariableName))
-    return Status;
+//
+// decides which BlockIo devices can contain boot images at all
+//
+STATIC
+BOOLEAN
+ProbePolicyAllows (
+  IN EFI_HANDLE             Handle,
+  IN EFI_BLOCK_IO_PROTOCOL  *BlockIo
+)
+{
+  EFI_STATUS                  Status;
+  EFI_PARTITION_NAME_PROTOCOL *PartitionNameProtocol;
+  CHAR8                       *PartitionNameAscii;
+  FSTAB_REC                   *Rec;
+
+  // fixed disks are partitioned, images live in their partitions.
+  // not every driver sets LogicalPartition, so partitions are recognized by their HD node too
+  if (!BlockIo->Media->RemovableMedia && !BlockIo->Media->LogicalPartition && GetPartitionNode(DevicePathFromHandle(Handle)) == NULL)
+    return FALSE;
+
+  Status = gBS->HandleProtocol (Handle, &gEfiPartitionNameProtocolGuid, (VOID **)&PartitionNameProtocol);
+  if (EFI_ERROR (Status) || !PartitionNameProtocol->Name[0])
+    return TRUE;
+
+  PartitionNameAscii = Unicode2Ascii(PartitionNameProtocol->Name);
+  if (PartitionNameAscii == NULL)
+    return TRUE;
+  Rec = FstabGetByPartitionName(mFstab, PartitionNameAscii);
+  FreePool(PartitionNameAscii);
+
+  // partitions with any fstab role but boot and recovery hold filesystems or firmware
+  if (Rec && !FstabIsUEFI(Rec) && AsciiStrCmp(Rec->mount_point, "/boot") && AsciiStrCmp(Rec->mount_point, "/recovery"))
+    return FALSE;
+
+  return TRUE;
+}
+
+//
+// multiboot ROMs found during previous scans. an entry stays valid as long as
+// neither the ROM directory nor its multiboot.ini were modified
+//
+typedef struct {
+  MULTIBOOT_INDEX_ENTRY Entry;
+  BOOLEAN               Used;
+} MULTIBOOT_INDEX_ITEM;
+
+STATIC MULTIBOOT_INDEX_ITEM *mMultibootIndex = NULL;
+STATIC UINTN                mMultibootIndexCount = 0;
+STATIC UINTN                mMultibootIndexCapacity = 0;
+STATIC BOOLEAN              mMultibootIndexDirty = FALSE;
+
+STATIC
+VOID
+MultibootIndexLoad (
+  VOID
+)
+{
+  EFI_STATUS            Status;
+  UINTN                 Index;
+  CACHE_VARIABLE_HEADER *Header;
+  MULTIBOOT_INDEX_ENTRY *Entries;
+
+  Status = CacheVariableRead(L"MultibootIndex", MULTIBOOT_INDEX_VERSION, sizeof(*Entries), &Header);
+  if (EFI_ERROR (Status)) {
+    mMultibootIndexDirty = (Status != EFI_NOT_FOUND);
+    return;
+  }
+
+  mMultibootIndex = AllocatePool(Header->Count * sizeof(*mMultibootIndex));
+  if (mMultibootIndex == NULL) {
+    FreePool(Header);
+    mMultibootIndexDirty = TRUE;
+    return;
+  }
+
+  Entries = (MULTIBOOT_INDEX_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Header->Count; Index++) {
+    CopyMem(&mMultibootIndex[Index].Entry, &Entries[Index], sizeof(*Entries));
+    mMultibootIndex[Index].Used = FALSE;
+  }
+  mMultibootIndexCount = mMultibootIndexCapacity = Header->Count;
+
+  FreePool(Header);
+}
+
+STATIC
+VOID
+MultibootIndexSave (
+  VOID
+)
+{
+  UINTN                 Index;
+  UINTN                 Count;
+  UINTN                 Size;
+  CACHE_VARIABLE_HEADER *Header;
+  MULTIBOOT_INDEX_ENTRY *Entries;
+
+  // drop ROMs which weren't found during the scan
+  Count = 0;
+  for (Index = 0; Index < mMultibootIndexCount; Index++) {
+    if (!mMultibootIndex[Index].Used) {
+      mMultibootIndexDirty = TRUE;
+      continue;
+    }
+
+    if (Count != Index)
+      CopyMem(&mMultibootIndex[Count], &mMultibootIndex[Index], sizeof(*mMultibootIndex));
+    Count++;
+  }
+  mMultibootIndexCount = Count;
+
+  if (!mMultibootIndexDirty)
+    return;
+
+  Size = sizeof(*Header) + Count * sizeof(*Entries);
+  Header = AllocatePool(Size);
+  if (Header == NULL)
+    return;
+
+  Header->Version = MULTIBOOT_INDEX_VERSION;
+  Header->Count = Count;
+  Entries = (MULTIBOOT_INDEX_ENTRY*)(Header + 1);
+  for (Index = 0; Index < Count; Index++) {
+    CopyMem(&Entries[Index], &mMultibootIndex[Index].Entry, sizeof(*Entries));
+  }
+
+  if (!EFI_ERROR (UtilSetEFIDroidDataVariable(L"MultibootIndex", Header, Size)))
+    mMultibootIndexDirty = FALSE;
+
+  FreePool(Header);
+}
+
+STATIC
+MULTIBOOT_INDEX_ITEM*
+MultibootIndexFind (
+  IN UINT32 PathCrc
+)
+{
+  UINTN Index;
+
+  for (Index = 0; Index < mMultibootIndexCount; Index++) {
+    if (mMultibootIndex[Index].Entry.PathCrc == PathCrc)
+      return &mMultibootIndex[Index];
+  }
+
+  return NULL;
+}
+
+//
+// returns the indexed ROM if it didn't change since it was stored
+//
+STATIC
+CONST MULTIBOOT_INDEX_ENTRY*
+MultibootIndexLookup (
+  IN UINT32              PathCrc,
+  IN CONST EFI_FILE_INFO *DirInfo,
+  IN CONST EFI_FILE_INFO *IniInfo
+)
+{
+  MULTIBOOT_INDEX_ITEM *Item;
+
+  Item = MultibootIndexFind(PathCrc);
+  if (Item == NULL)
+    return NULL;
 
-  // add to list
-  AddCacheVariableToList(List, VariableName);
+  if (Item->Entry.IniSize != IniInfo->FileSize)
+    return NULL;
+  if (CompareMem(&Item->Entry.IniTime, &IniInfo->ModificationTime, sizeof(EFI_TIME)))
+    return NULL;
+  if (CompareMem(&Item->Entry.DirTime, &DirInfo->ModificationTime, sizeof(EFI_TIME)))
+    return NULL;
 
-  return Status;
+  Item->Used = TRUE;
+  return &Item->Entry;
 }
 
 STATIC
 VOID
-RemovedUnusedCacheVariables (
-  VOID
+MultibootIndexStore (
+  IN UINT32                   PathCrc,
+  IN CONST EFI_FILE_INFO      *DirInfo,
+  IN CONST EFI_FILE_INFO      *IniInfo,
+  IN CONST multiboot_handle_t *mbhandle,
+  IN BOOLEAN                  HasIcon
 )
 {
-  LIST_ENTRY VariableRemovalList;
-  LIST_ENTRY* Link;
-  STRING_LIST_ITEM* Item;
+  MULTIBOOT_INDEX_ITEM *Item;
+  MULTIBOOT_INDEX_ITEM *NewIndex;
+  UINTN                NewCapacity;
 
-  InitializeListHead(&VariableRemovalList);
+  // ROMs with values which don't fit get parsed during every scan
+  if (AsciiStrSize(mbhandle->Name) > sizeof(Item->Entry.Name))
+    return;
+  if (mbhandle->Description && AsciiStrSize(mbhandle->Description) > sizeof(Item->Entry.Description))
+    return;
 
-  // build list of variables to remove
-  UtilIterateVariables(IterateVariablesCallbackAddToList, &VariableRemovalList);
+  Item = MultibootIndexFind(PathCrc);
+  if (Item == NULL) {
+    if (mMultibootIndexCount == mMultibootIndexCapacity) {
+      NewCapacity = MAX(mMultibootIndexCapacity * 2, 8);
+      NewIndex = ReallocatePool(mMultibootIndexCapacity * sizeof(*mMultibootIndex), NewCapacity * sizeof(*mMultibootIndex), mMultibootIndex);
+      if (NewIndex == NULL)
+        return;
 
-  // remove all unused variables
-  for (Link = GetFirstNode (&VariableRemovalList);
-       !IsNull (&VariableRemovalList, Link);
-       Link = GetNextNode (&VariableRemovalList, Link)
-      ) {
-    Item = CR (Link, STRING_LIST_ITEM, Link, STRING_LIST_SIGNATURE);
+      mMultibootIndex = NewIndex;
+      mMultibootIndexCapacity = NewCapacity;
+    }
 
-    UtilSetEFIDroidDataVariable(Item->VariableName, NULL, 0);
+    Item = &mMultibootIndex[mMultibootIndexCount++];
   }
+
+  SetMem(&Item->Entry, sizeof(Item->Entry), 0);
+  Item->Entry.PathCrc = PathCrc;
+  Item->Entry.IniSize = IniInfo->FileSize;
+  CopyMem(&Item->Entry.IniTime, &IniInfo->ModificationTime, sizeof(EFI_TIME));
+  CopyMem(&Item->Entry.DirTime, &DirInfo->ModificationTime, sizeof(EFI_TIME));
+  CopyMem(Item->Entry.Name, mbhandle->Name, AsciiStrSize(mbhandle->Name));
+  if (mbhandle->Description)
+    CopyMem(Item->Entry.Description, mbhandle->Description, AsciiStrSize(mbhandle->Description));
+  Item->Entry.HasIcon = HasIcon;
+
+  Item->Used = TRUE;
+  mMultibootIndexDirty = TRUE;
 }
 
 STATIC
@@ -198,6 +802,56 @@ MenuBootEntryCloneCallback (
   return EFI_SUCCESS;
 }
 
+//
+// multiboot entries get identified when they're booted, not during the scan
+//
+STATIC
+EFI_STATUS
+AndroidPrepareBootEntry (
+  IN MENU_ENTRY_PDATA *PData
+)
+{
+  EFI_STATUS          Status;
+  EFI_FILE_PROTOCOL   *BootFile;
+  PARTITION_LIST_ITEM *BootPartition;
+  CHAR8               Buf[100];
+
+  Status = AndroidLocatorLoadMultibootHandle(PData->mbhandle);
+  if (EFI_ERROR (Status)) {
+    AsciiSPrint(Buf, sizeof(Buf), "Can't load multiboot.ini: %r", Status);
+    MenuShowMessage("Error", Buf);
+    return Status;
+  }
+
+  if (!PData->IdentifyPending)
+    return EFI_SUCCESS;
+
+  BootPartition = LoaderGetPartitionItem(PData->mbhandle, L"boot");
+  if (BootPartition == NULL) {
+    MenuShowMessage("Error", "multiboot.ini doesn't have a boot partition.");
+    return EFI_NOT_FOUND;
+  }
+
+  Status = PData->mbhandle->ROMDirectory->Open (
+                   PData->mbhandle->ROMDirectory,
+                   &BootFile,
+                   BootPartition->Value,
+                   EFI_FILE_MODE_READ,
+                   0
+                   );
+  if (EFI_ERROR (Status)) {
+    AsciiSPrint(Buf, sizeof(Buf), "Can't open boot image: %r", Status);
+    MenuShowMessage("Error", Buf);
+    return Status;
+  }
+
+  // the loader checks the result
+  libboot_identify_file(BootFile, PData->context);
+  PData->IdentifyPending = FALSE;
+
+  return EFI_SUCCESS;
+}
+
 STATIC
 EFI_STATUS
 AndroidBootCallback (
@@ -205,8 +859,13 @@ AndroidBootCallback (
 )
 {
   MENU_ENTRY_PDATA *PData = This->Private;
+  EFI_STATUS       Status;
+
+  Status = AndroidPrepareBootEntry(PData);
+  if (EFI_ERROR (Status))
+    return Status;
 
-  return LoaderBootContext(PData->context, PData->mbhandle, PData->DisablePatching, PData->IsRecovery, &PData->LastBootEntry);
+  return LoaderBootContext(PData->context, PData->mbhandle, PData->DisablePatching, PData->IsRecovery, PData->RamdiskType, &PData->LastBootEntry);
 }
 
 STATIC
@@ -219,8 +878,12 @@ AndroidBootLongPressCallback (
 
   INT32 Selection = MenuShowDialog("Unpatched boot", "Do you want to boot without any ramdisk patching?", "OK", "CANCEL");
   if(Selection==0) {
+    EFI_STATUS Status = AndroidPrepareBootEntry(PData);
+    if (EFI_ERROR (Status))
+      return Status;
+
     RenderBootScreen(This);
-    return LoaderBootContext(PData->context, PData->mbhandle, TRUE, PData->IsRecovery, &PData->LastBootEntry);
+    return LoaderBootContext(PData->context, PData->mbhandle, TRUE, PData->IsRecovery, PData->RamdiskType, &PData->LastBootEntry);
   }
   return EFI_SUCCESS;
 }
@@ -402,7 +1065,9 @@ AddMultibootSystemToRecoveryMenu (
 
     MENU_ENTRY_PDATA* NewEntryPData = NewEntry->Private;
     NewEntryPData->mbhandle = mbhandle;
+    // this boots the recovery, not the ROM the entry points to
     NewEntryPData->LastBootEntry = EntryPData->LastBootEntry;
+    NewEntryPData->LastBootEntry.Flags |= LAST_BOOT_FLAG_INDIRECT;
     if(NewEntry->Name)
       FreePool(NewEntry->Name);
     NewEntry->Name = AsciiStrDup(mbhandle->Name);
@@ -604,41 +1269,194 @@ Done:
   return Status;
 }
 
+// files we look for in ramdisks
+enum {
+  RDINFO_PROBE_RECOVERY = 0,
+  RDINFO_PROBE_TWRP,
+  RDINFO_PROBE_PHILZ,
+  RDINFO_PROBE_CLOCKWORK,
+  RDINFO_PROBE_CYANOGEN,
+  RDINFO_PROBE_LGLAF,
+  RDINFO_PROBE_XIAOMI,
+  RDINFO_PROBE_FOTA,
+  RDINFO_PROBE_DUAL_ANDROID,
+  RDINFO_PROBE_DUAL_RECOVERY,
+  RDINFO_PROBE_COUNT,
+};
+
+STATIC CONST CHAR8 *mRdInfoProbeNames[RDINFO_PROBE_COUNT] = {
+  "sbin/recovery",
+  "sbin/twrp",
+  "sbin/raw-backup.sh",
+  "res/images/icon_clockwork.png",
+  "res/images/font_log.png",
+  "sbin/lafd",
+  "res/images/icon_smile.png",
+  "fota_kernel",
+  "sbin/ramdisk.cpio",
+  "sbin/ramdisk-recovery.cpio",
+};
+
+#define RDINFO_FOUND(Found, Id) (((Found) & (1 << (Id))) != 0)
+
+typedef struct _RDINFO_PROBE RDINFO_PROBE;
+struct _RDINFO_PROBE {
+  CPIO_WALKER   Walker;
+  UINT32        Found;
+  UINT32        Wanted;
+
+  // probes for the archives embedded in dual ramdisks
+  RDINFO_PROBE  *Dual;
+  RDINFO_PROBE  *Current;
+};
+
+STATIC
+BOOLEAN
+RdInfoProbeResolved (
+  IN RDINFO_PROBE       *Probe
+)
+{
+  // a dual ramdisk is resolved once both embedded archives were probed
+  if (Probe->Dual && RDINFO_FOUND(Probe->Found, RDINFO_PROBE_DUAL_ANDROID) && RDINFO_FOUND(Probe->Found, RDINFO_PROBE_DUAL_RECOVERY)) {
+    return CpioWalkDone(&Probe->Dual[0].Walker) && CpioWalkDone(&Probe->Dual[1].Walker);
+  }
+
+  // the absence of a file is only known at the trailer,
+  // so this relies on RdInfoProbeDrop removing the files which can't change the result
+  return (Probe->Found & Probe->Wanted) == Probe->Wanted;
+}
+
+//
+// stop looking for files which can't change GetAndroidImgInfo's result anymore
+//
+STATIC
+VOID
+RdInfoProbeDrop (
+  IN RDINFO_PROBE       *Probe,
+  IN UINTN              Id
+)
+{
+  UINTN                 Lower;
+
+  // the first recovery type in GetAndroidImgInfo's order wins
+  if (Id >= RDINFO_PROBE_TWRP && Id <= RDINFO_PROBE_XIAOMI) {
+    for (Lower=Id+1; Lower<=RDINFO_PROBE_XIAOMI; Lower++)
+      Probe->Wanted &= ~(1 << Lower);
+  }
+
+  if (Id == RDINFO_PROBE_RECOVERY) {
+    // FOTA only matters for ramdisks without a recovery
+    Probe->Wanted &= ~(1 << RDINFO_PROBE_FOTA);
+
+    // dual ramdisks keep their recovery in the embedded archive.
+    // sorted archives list both before sbin/recovery, so this one isn't dual
+    if (!RDINFO_FOUND(Probe->Found, RDINFO_PROBE_DUAL_ANDROID) && !RDINFO_FOUND(Probe->Found, RDINFO_PROBE_DUAL_RECOVERY))
+      Probe->Wanted &= ~((1 << RDINFO_PROBE_DUAL_ANDROID) | (1 << RDINFO_PROBE_DUAL_RECOVERY));
+  }
+}
+
+STATIC
+CPIO_WALK_ACTION
+RdInfoProbeEntry (
+  VOID                  *Context,
+  CONST CHAR8           *Name,
+  UINT32                Mode,
+  UINTN                 FileSize
+)
+{
+  RDINFO_PROBE          *Probe = Context;
+  UINTN                 Id;
+
+  // stop decompressing as soon as we know everything we need
+  if (RdInfoProbeResolved(Probe))
+    return CPIO_WALK_STOP;
+
+  for (Id=0; Id<RDINFO_PROBE_COUNT; Id++) {
+    if (!RDINFO_FOUND(Probe->Wanted, Id) || AsciiStrCmp(Name, mRdInfoProbeNames[Id]))
+      continue;
+
+    Probe->Found |= (1 << Id);
+    RdInfoProbeDrop(Probe, Id);
+
+    // walk the embedded archive while it's passing by
+    if (Probe->Dual && (Id==RDINFO_PROBE_DUAL_ANDROID || Id==RDINFO_PROBE_DUAL_RECOVERY)) {
+      Probe->Current = &Probe->Dual[Id - RDINFO_PROBE_DUAL_ANDROID];
+      return CPIO_WALK_DATA;
+    }
+    break;
+  }
+
+  return CPIO_WALK_SKIP;
+}
+
+STATIC
+EFI_STATUS
+RdInfoProbeData (
+  VOID                  *Context,
+  CONST VOID            *Data,
+  UINTN                 Size
+)
+{
+  RDINFO_PROBE          *Probe = Context;
+
+  // errors in the embedded archive only affect its own probe
+  CpioWalkFeed(&Probe->Current->Walker, Data, Size);
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+RdInfoProbeInit (
+  IN RDINFO_PROBE       *Probe,
+  IN RDINFO_PROBE       *Dual
+)
+{
+  SetMem(Probe, sizeof(*Probe), 0);
+  CpioWalkInit(&Probe->Walker, RdInfoProbeEntry, RdInfoProbeData, Probe);
+
+  Probe->Wanted = (1 << RDINFO_PROBE_COUNT) - 1;
+  if (Dual==NULL) {
+    Probe->Wanted &= ~((1 << RDINFO_PROBE_DUAL_ANDROID) | (1 << RDINFO_PROBE_DUAL_RECOVERY));
+  }
+  Probe->Dual = Dual;
+}
+
 STATIC
 VOID
 GetAndroidImgInfo (
-  IN CPIO_NEWC_HEADER   *Ramdisk,
+  IN UINT32             Found,
   CONST CHAR8           **IconPath,
   CONST CHAR8           **ImgName,
   BOOLEAN               *IsRecovery
 )
 {
   // check if this is a recovery ramdisk
-  if (CpioGetByName(Ramdisk, "sbin/recovery")) {
+  if (RDINFO_FOUND(Found, RDINFO_PROBE_RECOVERY)) {
     *IsRecovery = TRUE;
 
     // set icon and description
-    if (CpioGetByName(Ramdisk, "sbin/twrp")) {
+    if (RDINFO_FOUND(Found, RDINFO_PROBE_TWRP)) {
       *IconPath = "icons/recovery_twrp.png";
       *ImgName = "TWRP";
     }
-    else if (CpioGetByName(Ramdisk, "sbin/raw-backup.sh")) {
+    else if (RDINFO_FOUND(Found, RDINFO_PROBE_PHILZ)) {
       *IconPath = "icons/recovery_clockwork.png";
       *ImgName = "PhilZ Touch";
     }
-    else if (CpioGetByName(Ramdisk, "res/images/icon_clockwork.png")) {
+    else if (RDINFO_FOUND(Found, RDINFO_PROBE_CLOCKWORK)) {
       *IconPath = "icons/recovery_clockwork.png";
       *ImgName = "ClockworkMod Recovery";
     }
-    else if (CpioGetByName(Ramdisk, "res/images/font_log.png")) {
+    else if (RDINFO_FOUND(Found, RDINFO_PROBE_CYANOGEN)) {
       *IconPath = "icons/recovery_cyanogen.png";
       *ImgName = "Cyanogen Recovery";
     }
-    else if (CpioGetByName(Ramdisk, "sbin/lafd")) {
+    else if (RDINFO_FOUND(Found, RDINFO_PROBE_LGLAF)) {
       *IconPath = "icons/recovery_lglaf.png";
       *ImgName = "LG Laf Recovery";
     }
-    else if (CpioGetByName(Ramdisk, "res/images/icon_smile.png")) {
+    else if (RDINFO_FOUND(Found, RDINFO_PROBE_XIAOMI)) {
       *IconPath = "icons/recovery_xiaomi.png";
       *ImgName = "Xiaomi Recovery";
     }
@@ -648,7 +1466,7 @@ GetAndroidImgInfo (
     }
   }
 
-  else if (CpioGetByName(Ramdisk, "fota_kernel")) {
+  else if (RDINFO_FOUND(Found, RDINFO_PROBE_FOTA)) {
     *IconPath = "icons/sony.png";
     *ImgName = "Sony FOTA";
     *IsRecovery = TRUE;
@@ -668,43 +1486,33 @@ RDInfoCacheRead (
   INTN                      Id
 )
 {
-  EFI_STATUS Status;
+  EFI_STATUS        Status;
+  RDINFO_CACHE_ITEM *Item;
 
   // try to get info from cache
-  if (context->checksum) {
-    // build variable name
-    CHAR16 Buf[50];
-    if(Id>=0)
-      UnicodeSPrint(Buf, sizeof(Buf), L"RdInfoCache-%08x-%u", context->checksum, Id);
-    else
-      UnicodeSPrint(Buf, sizeof(Buf), L"RdInfoCache-%08x", context->checksum);
-
-    // get variable
-    AddCacheVariableToList(&mUsedCacheVariables, Buf);
-    IMGINFO_CACHE* Cache = UtilGetEFIDroidDataVariable(Buf);
-    if(!Cache) {
-      return EFI_NOT_FOUND;
-    }
+  if (!context->checksum)
+    return EFI_NOT_FOUND;
 
-    // copy to OutCache
-    CopyMem(OutCache, Cache, sizeof(*OutCache));
+  Item = RdInfoCacheFind(context->checksum, (INT32)Id);
+  if (Item == NULL)
+    return EFI_NOT_FOUND;
 
-    // handle dualImage
-    if(Cache->IsDual && OutCacheDual) {
-      Status = RDInfoCacheRead(context, &OutCacheDual[0], NULL, 0);
-      if(EFI_ERROR(Status))
-        return EFI_NOT_FOUND;
+  // copy to OutCache
+  Item->Used = TRUE;
+  CopyMem(OutCache, &Item->Entry.Info, sizeof(*OutCache));
 
-      Status = RDInfoCacheRead(context, &OutCacheDual[1], NULL, 1);
-      if(EFI_ERROR(Status))
-        return EFI_NOT_FOUND;
-    }
+  // handle dualImage
+  if(OutCache->IsDual && OutCacheDual) {
+    Status = RDInfoCacheRead(context, &OutCacheDual[0], NULL, 0);
+    if(EFI_ERROR(Status))
+      return EFI_NOT_FOUND;
 
-    FreePool(Cache);
-    return EFI_SUCCESS;
+    Status = RDInfoCacheRead(context, &OutCacheDual[1], NULL, 1);
+    if(EFI_ERROR(Status))
+      return EFI_NOT_FOUND;
   }
 
-  return EFI_NOT_FOUND;
+  return EFI_SUCCESS;
 }
 
 STATIC
@@ -713,7 +1521,7 @@ RdInfoCacheBuildDual (
   bootimg_context_t         *context,
   IMGINFO_CACHE             *OutCache,
   UINTN                     Id,
-  CPIO_NEWC_HEADER          *Ramdisk
+  UINT32                    Found
 )
 {
   CONST CHAR8               *IconPath = NULL;
@@ -721,7 +1529,7 @@ RdInfoCacheBuildDual (
   BOOLEAN                   IsRecovery = FALSE;
 
   // build info from ramdisk contents
-  GetAndroidImgInfo(Ramdisk, &IconPath, &ImgName, &IsRecovery);
+  GetAndroidImgInfo(Found, &IconPath, &ImgName, &IsRecovery);
 
   // copy info to OutCache
   AsciiSPrint(OutCache->Name, sizeof(OutCache->Name), "%a", ImgName?:"");
@@ -730,12 +1538,8 @@ RdInfoCacheBuildDual (
   OutCache->IsDual = FALSE;
 
   // store info in cache
-  if (context->checksum) {
-    CHAR16 Buf[50];
-    UnicodeSPrint(Buf, sizeof(Buf), L"RdInfoCache-%08x-%u", context->checksum, Id);
-    AddCacheVariableToList(&mUsedCacheVariables, Buf);
-    UtilSetEFIDroidDataVariable(Buf, OutCache, sizeof(*OutCache));
-  }
+  if (context->checksum)
+    RdInfoCacheStore(context->checksum, (INT32)Id, OutCache);
 }
 
 STATIC
@@ -747,11 +1551,12 @@ RDInfoCacheBuild (
 )
 {
   EFI_STATUS                Status;
-  EFI_STATUS                Status2;
   CONST CHAR8               *IconPath = NULL;
   CONST CHAR8               *ImgName = NULL;
   BOOLEAN                   IsRecovery = FALSE;
   BOOLEAN                   IsDual = FALSE;
+  RDINFO_PROBE              Probe;
+  RDINFO_PROBE              DualProbes[2];
 
   // show progress dialog on first scan
   if (mFirstCacheScan) {
@@ -759,42 +1564,25 @@ RDInfoCacheBuild (
     mFirstCacheScan = FALSE;
   }
 
-  // decompress ramdisk
-  CPIO_NEWC_HEADER *Ramdisk = NULL;
-  Status = LoaderGetDecompressedRamdisk (context, &Ramdisk);
+  // stream the ramdisk through the probes instead of decompressing all of it
+  RdInfoProbeInit(&Probe, DualProbes);
+  RdInfoProbeInit(&DualProbes[0], NULL);
+  RdInfoProbeInit(&DualProbes[1], NULL);
+  Status = LoaderWalkRamdisk (context, &Probe.Walker);
   if(!EFI_ERROR(Status)) {
-    CPIO_NEWC_HEADER* DualRamdiskAndroidHdr = CpioGetByName(Ramdisk, "sbin/ramdisk.cpio");
-    CPIO_NEWC_HEADER* DualRamdiskRecoveryHdr = CpioGetByName(Ramdisk, "sbin/ramdisk-recovery.cpio");
-    if (DualRamdiskAndroidHdr && DualRamdiskRecoveryHdr) {
-      // get android ramdisk
-      CPIO_NEWC_HEADER* DualRamdiskAndroid;
-      UINTN DualRamdiskAndroidSize;
-      Status = CpioGetData(DualRamdiskAndroidHdr, (VOID**)&DualRamdiskAndroid, &DualRamdiskAndroidSize);
-
-      // get recovery ramdisk
-      CPIO_NEWC_HEADER* DualRamdiskRecovery;
-      UINTN DualRamdiskRecoverySize;
-      Status2 = CpioGetData(DualRamdiskRecoveryHdr, (VOID**)&DualRamdiskRecovery, &DualRamdiskRecoverySize);
-
-      if(!EFI_ERROR(Status) && !EFI_ERROR(Status2)) {
-        IsDual = TRUE;
-
-        RdInfoCacheBuildDual(context, &OutCacheDual[0], 0, DualRamdiskAndroid);
-        RdInfoCacheBuildDual(context, &OutCacheDual[1], 1, DualRamdiskRecovery);
-      }
+    if (RDINFO_FOUND(Probe.Found, RDINFO_PROBE_DUAL_ANDROID) && RDINFO_FOUND(Probe.Found, RDINFO_PROBE_DUAL_RECOVERY)) {
+      IsDual = TRUE;
+
+      RdInfoCacheBuildDual(context, &OutCacheDual[0], 0, DualProbes[0].Found);
+      RdInfoCacheBuildDual(context, &OutCacheDual[1], 1, DualProbes[1].Found);
     }
 
     else {
       // build info from ramdisk contents
-      GetAndroidImgInfo(Ramdisk, &IconPath, &ImgName, &IsRecovery);
+      GetAndroidImgInfo(Probe.Found, &IconPath, &ImgName, &IsRecovery);
     }
   }
 
-  // cleanup
-  if (Ramdisk) {
-    FreePool(Ramdisk);
-  }
-
   // copy info to OutCache
   AsciiSPrint(OutCache->Name, sizeof(OutCache->Name), "%a", ImgName?:"");
   AsciiSPrint(OutCache->IconPath, sizeof(OutCache->IconPath), "%a", IconPath?:"");
@@ -802,12 +1590,8 @@ RDInfoCacheBuild (
   OutCache->IsDual = IsDual;
 
   // store info in cache
-  if (context->checksum) {
-    CHAR16 Buf[50];
-    UnicodeSPrint(Buf, sizeof(Buf), L"RdInfoCache-%08x", context->checksum);
-    AddCacheVariableToList(&mUsedCacheVariables, Buf);
-    UtilSetEFIDroidDataVariable(Buf, OutCache, sizeof(*OutCache));
-  }
+  if (context->checksum)
+    RdInfoCacheStore(context->checksum, -1, OutCache);
 }
 
 STATIC
@@ -818,6 +1602,7 @@ AndroidProcessOption (
   BOOLEAN                     IsInternalBoot,
   CONST CHAR16                *PartitionName,
   IMGINFO_CACHE               *Cache,
+  LOADER_RAMDISK_TYPE         RamdiskType,
   LAST_BOOT_ENTRY             *LastBootEntry
 )
 {
@@ -884,6 +1669,7 @@ AndroidProcessOption (
   EntryPData->context = context;
   EntryPData->LastBootEntry = *LastBootEntry;
   EntryPData->IsRecovery = Cache->IsRecovery;
+  EntryPData->RamdiskType = RamdiskType;
 
   if(Cache->IsRecovery) {
     // create recovery menu
@@ -941,6 +1727,7 @@ FindAndroidBlockIo (
   BOOLEAN                     IsInternalBoot = FALSE;
   IMGINFO_CACHE               Cache;
   IMGINFO_CACHE               CacheDual[2];
+  LOADER_RAMDISK_TYPE         RamdiskType = LOADER_RAMDISK_UNKNOWN;
   LAST_BOOT_ENTRY             LastBootEntry = {0};
   CHAR16                      *TmpStr = NULL;
   EFI_FILE_PROTOCOL           *BootFile = NULL;
@@ -965,6 +1752,11 @@ FindAndroidBlockIo (
     return Status;
   }
 
+  // skip devices which can't contain boot images
+  if (!ProbePolicyAllows(Handle, BlockIo)) {
+    return EFI_UNSUPPORTED;
+  }
+
   // setup context
   context = AllocatePool(sizeof(*context));
   if (context==NULL) {
@@ -1052,14 +1844,32 @@ FindAndroidBlockIo (
   }
 
   if (!context->rootio) {
+    // skip partitions which weren't bootable the last time we looked at them
+    PROBE_CACHE_ENTRY Identity;
+    BOOLEAN HasIdentity = !EFI_ERROR(ProbeCacheGetIdentity(DevicePath, BlockIo, &Identity));
+    if (HasIdentity && ProbeCacheContains(&Identity)) {
+      Status = EFI_UNSUPPORTED;
+      goto FREEBUFFER;
+    }
+
     // identify
-    INTN rc = libboot_identify_blockio(BlockIo, context);
-    if(rc) goto FREEBUFFER;
+    // only remember partitions which were read completely and don't contain an image
+    Status = LoaderIdentifyBlockIo(BlockIo, context);
+    if (EFI_ERROR (Status)) {
+      if (HasIdentity && Status == EFI_UNSUPPORTED)
+        ProbeCacheAdd(&Identity);
+      Status = EFI_UNSUPPORTED;
+      goto FREEBUFFER;
+    }
 
     // hide qcmbn images and ELF's like tz and rpm
     // we don't do this for replacement partitions because the user may want to boot these image types
-    if(context->type==BOOTIMG_TYPE_QCMBN || (context->type==BOOTIMG_TYPE_ELF && context->magic_test_result==1))
+    if(context->type==BOOTIMG_TYPE_QCMBN || (context->type==BOOTIMG_TYPE_ELF && context->magic_test_result==1)) {
+      if (HasIdentity)
+        ProbeCacheAdd(&Identity);
+      Status = EFI_UNSUPPORTED;
       goto FREEBUFFER;
+    }
   }
 
   // get information about ramdisk
@@ -1068,17 +1878,20 @@ FindAndroidBlockIo (
     if (EFI_ERROR(Status)) {
       RDInfoCacheBuild(context, &Cache, CacheDual);
     }
+
+    // we know what's in the ramdisk now, so booting doesn't have to decompress it
+    RamdiskType = LOADER_RAMDISK_SINGLE;
   }
 
   if(Cache.IsDual) {
     // process android option
-    Status = AndroidProcessOption(context, FALSE, IsInternalBoot, PartitionName, &CacheDual[0], &LastBootEntry);
+    Status = AndroidProcessOption(context, FALSE, IsInternalBoot, PartitionName, &CacheDual[0], LOADER_RAMDISK_DUAL, &LastBootEntry);
     if(EFI_ERROR(Status)) {
       goto FREEBUFFER;
     }
 
     // process recovery option
-    Status = AndroidProcessOption(context, FALSE, IsInternalBoot, PartitionName, &CacheDual[1], &LastBootEntry);
+    Status = AndroidProcessOption(context, FALSE, IsInternalBoot, PartitionName, &CacheDual[1], LOADER_RAMDISK_DUAL, &LastBootEntry);
     if(EFI_ERROR(Status)) {
       goto FREEBUFFER;
     }
@@ -1086,7 +1899,7 @@ FindAndroidBlockIo (
 
   else {
     // process option
-    Status = AndroidProcessOption(context, IsInternalRecovery, IsInternalBoot, PartitionName, &Cache, &LastBootEntry);
+    Status = AndroidProcessOption(context, IsInternalRecovery, IsInternalBoot, PartitionName, &Cache, RamdiskType, &LastBootEntry);
     if(EFI_ERROR(Status)) {
       goto FREEBUFFER;
     }
@@ -1117,10 +1930,15 @@ IniHandler (
   multiboot_handle_t* mbhandle = (multiboot_handle_t*)Private;
 
   if(!AsciiStrCmp(Section, "config")) {
+    // the name and description may have been set from the index already
     if(!AsciiStrCmp(Name, "name")) {
+      if(mbhandle->Name)
+        FreePool(mbhandle->Name);
       mbhandle->Name = AsciiStrDup(Value);
     }
     if(!AsciiStrCmp(Name, "description")) {
+      if(mbhandle->Description)
+        FreePool(mbhandle->Description);
       mbhandle->Description = AsciiStrDup(Value);
     }
   }
@@ -1165,6 +1983,37 @@ FreeMbHandle (
   FreePool(mbhandle);
 }
 
+//
+// parses multiboot.ini of a ROM which was created from the index
+//
+EFI_STATUS
+AndroidLocatorLoadMultibootHandle (
+  multiboot_handle_t *mbhandle
+)
+{
+  EFI_STATUS        Status;
+  EFI_FILE_PROTOCOL *FileMultibootIni;
+
+  if (mbhandle == NULL || mbhandle->IniParsed)
+    return EFI_SUCCESS;
+
+  Status = mbhandle->ROMDirectory->Open (
+                   mbhandle->ROMDirectory,
+                   &FileMultibootIni,
+                   L"multiboot.ini",
+                   EFI_FILE_MODE_READ,
+                   0
+                   );
+  if (EFI_ERROR (Status))
+    return Status;
+
+  IniParseEfiFile(FileMultibootIni, IniHandler, mbhandle);
+  FileHandleClose(FileMultibootIni);
+  mbhandle->IniParsed = TRUE;
+
+  return EFI_SUCCESS;
+}
+
 STATIC
 EFI_STATUS
 FindMultibootSFSInternal (
@@ -1178,7 +2027,7 @@ FindMultibootSFSInternal (
   EFI_STATUS                        Status;
   EFI_FILE_INFO                     *NodeInfo;
   BOOLEAN                           NoFile;
-  LAST_BOOT_ENTRY                   LastBootEntry = {0};
+  LAST_BOOT_ENTRY                   LastBootEntry;
 
   // enumerate directories
   NoFile      = FALSE;
@@ -1188,9 +2037,12 @@ FindMultibootSFSInternal (
       ; Status = FileHandleFindNextFile(DirMultiboot, NodeInfo, &NoFile)
      ){
     EFI_FILE_PROTOCOL                 *FileMultibootIni = NULL;
+    EFI_FILE_INFO                     *IniInfo = NULL;
     CHAR16                            *FilenameBuf = NULL;
     multiboot_handle_t                *mbhandle = NULL;
     bootimg_context_t                 *context = NULL;
+    CONST MULTIBOOT_INDEX_ENTRY       *IndexEntry = NULL;
+    UINT32                            PathCrc = 0;
 
     // ignore directories
     if(!NodeIsDir(NodeInfo))
@@ -1237,9 +2089,6 @@ FindMultibootSFSInternal (
       goto NEXT;
     }
 
-    // parse ini
-    IniParseEfiFile(FileMultibootIni, IniHandler, mbhandle);
-
     // get filename
     CHAR16* fname;
     Status = FileHandleGetFileName(FileMultibootIni, &fname);
@@ -1248,6 +2097,8 @@ FindMultibootSFSInternal (
     }
 
     // build lastbootentry info
+    // it's zeroed completely because its crc is the ROM's index key
+    SetMem(&LastBootEntry, sizeof(LastBootEntry), 0);
     LastBootEntry.Type = LAST_BOOT_TYPE_MULTIBOOT;
     CHAR16 *TmpStr = gEfiDevicePathToTextProtocol->ConvertDevicePathToText(DevicePath, FALSE, FALSE);
     AsciiSPrint(LastBootEntry.TextDevicePath, sizeof(LastBootEntry.TextDevicePath), "%s", TmpStr);
@@ -1265,29 +2116,35 @@ FindMultibootSFSInternal (
       goto NEXT;
     }
 
+    // use the index if neither the directory nor the ini changed
+    gBS->CalculateCrc32(&LastBootEntry, sizeof(LastBootEntry), &PathCrc);
+    IniInfo = FileHandleGetInfo(FileMultibootIni);
+    if (IniInfo)
+      IndexEntry = MultibootIndexLookup(PathCrc, NodeInfo, IniInfo);
+
+    if (IndexEntry) {
+      mbhandle->Name = AsciiStrDup(IndexEntry->Name);
+      if (IndexEntry->Description[0])
+        mbhandle->Description = AsciiStrDup(IndexEntry->Description);
+    }
+    else {
+      // parse ini
+      IniParseEfiFile(FileMultibootIni, IniHandler, mbhandle);
+      mbhandle->IniParsed = TRUE;
+    }
+
     // add menu entry
-    PARTITION_LIST_ITEM *BootPartition = LoaderGetPartitionItem(mbhandle, L"boot");
-    if(mbhandle->Name && BootPartition) {
-      EFI_FILE_PROTOCOL     *BootFile;
+    // indexed ROMs had a boot partition when they were stored
+    if(mbhandle->Name && (IndexEntry || LoaderGetPartitionItem(mbhandle, L"boot"))) {
       EFI_FILE_PROTOCOL     *IconFile;
       LIBAROMA_STREAMP      IconStream = NULL;
-
-      // open boot file
-      Status = mbhandle->ROMDirectory->Open (
-                       mbhandle->ROMDirectory,
-                       &BootFile,
-                       BootPartition->Value,
-                       EFI_FILE_MODE_READ,
-                       0
-                       );
-      if (EFI_ERROR (Status)) {
-        goto NEXT;
-      }
+      BOOLEAN               HasIcon = FALSE;
 
       // setup context
+      // it gets identified on boot because we want multiboot systems to be always visible
       context = AllocatePool(sizeof(*context));
       if (context == NULL) {
-        FileHandleClose(BootFile);
+        Status = EFI_OUT_OF_RESOURCES;
         goto NEXT;
       }
       custom_init_context(context);
@@ -1295,30 +2152,31 @@ FindMultibootSFSInternal (
       // create new menu entry
       MENU_ENTRY *Entry = MenuCreateBootEntry();
       if(Entry == NULL) {
-        FileHandleClose(BootFile);
         Status = EFI_OUT_OF_RESOURCES;
         goto NEXT;
       }
 
-      // identify
-      // ignore the result because we want multiboot systems to be always visible
-      libboot_identify_file(BootFile, context);
-
       // open icon file
-      Status = mbhandle->ROMDirectory->Open (
-                       mbhandle->ROMDirectory,
-                       &IconFile,
-                       L"icon.png",
-                       EFI_FILE_MODE_READ,
-                       0
-                       );
-      if (!EFI_ERROR (Status)) {
-        IconStream = libaroma_stream_efifile(IconFile);
-        FileHandleClose(IconFile);
+      if (IndexEntry == NULL || IndexEntry->HasIcon) {
+        Status = mbhandle->ROMDirectory->Open (
+                         mbhandle->ROMDirectory,
+                         &IconFile,
+                         L"icon.png",
+                         EFI_FILE_MODE_READ,
+                         0
+                         );
+        if (!EFI_ERROR (Status)) {
+          HasIcon = TRUE;
+          IconStream = libaroma_stream_efifile(IconFile);
+          FileHandleClose(IconFile);
+        }
       }
       if (IconStream==NULL)
         IconStream = libaroma_stream_ramdisk("icons/android.png");
 
+      if (IndexEntry == NULL && IniInfo)
+        MultibootIndexStore(PathCrc, NodeInfo, IniInfo, mbhandle, HasIcon);
+
       MenuAddAndroidGroupOnce();
 
       MENU_ENTRY_PDATA* EntryPData = Entry->Private;
@@ -1326,6 +2184,7 @@ FindMultibootSFSInternal (
       Entry->Name = AsciiStrDup(mbhandle->Name);
       Entry->Description = mbhandle->Description?AsciiStrDup(mbhandle->Description):NULL;
       EntryPData->context = context;
+      EntryPData->IdentifyPending = TRUE;
       EntryPData->LastBootEntry = LastBootEntry;
       EntryPData->mbhandle = mbhandle;
       MenuAddEntry(mBootMenuMain, Entry);
@@ -1353,6 +2212,11 @@ NEXT:
     FileHandleClose(FileMultibootIni);
     FileMultibootIni = NULL;
 
+    if(IniInfo) {
+      FreePool(IniInfo);
+      IniInfo = NULL;
+    }
+
     if(FilenameBuf) {
       FreePool(FilenameBuf);
       FilenameBuf = NULL;
@@ -1536,7 +2400,11 @@ AndroidLocatorInit (
   UINTN                               FstabSize;
 
   InitializeListHead(&mRecoveries);
-  InitializeListHead(&mUsedCacheVariables);
+
+  // load the entry caches
+  RdInfoCacheLoad();
+  ProbeCacheLoad();
+  MultibootIndexLoad();
 
   // get fstab data
   Status = UEFIRamdiskGetFile ("fstab.multiboot", (VOID **) &FstabBin, &FstabSize);
@@ -1784,6 +2652,9 @@ AndroidLocatorAddItems (
 {
   mFirstCacheScan = TRUE;
 
+  // start reading all partition headers, they arrive while we scan the filesystems
+  LoaderPrefetchBlockIoHeaders(ProbePolicyAllows);
+
   // find system partition
   VisitAllInstancesOfProtocol (
     &gEfiSimpleFileSystemProtocolGuid,
@@ -1799,6 +2670,7 @@ AndroidLocatorAddItems (
     FindAndroidBlockIo,
     NULL
     );
+  LoaderFreePrefetchedHeaders();
 
   // add Multiboot options
   VisitAllInstancesOfProtocol (
@@ -1823,8 +2695,10 @@ AndroidLocatorAddItems (
   // reset libboot error stack
   libboot_error_stack_reset();
 
-  // remove unused cache variables
-  RemovedUnusedCacheVariables();
+  // write back the entry caches
+  RdInfoCacheSave();
+  ProbeCacheSave();
+  MultibootIndexSave();
 
   return EFI_SUCCESS;
 }
@@ -1950,3 +2824,199 @@ AndroidLocatorHandleRecoveryMode (
 
   return EFI_SUCCESS;
 }
+
+STATIC
+EFI_STATUS
+LastBootEntryLocate (
+  IN  LAST_BOOT_ENTRY     *LastBootEntry,
+  IN  EFI_GUID            *Protocol,
+  OUT EFI_HANDLE          *Handle,
+  OUT VOID                **Interface
+)
+{
+  EFI_STATUS                Status;
+  CHAR16                    *TextDevicePath;
+  EFI_DEVICE_PATH_PROTOCOL  *DevicePath;
+  EFI_DEVICE_PATH_PROTOCOL  *RemainingDevicePath;
+
+  TextDevicePath = Ascii2Unicode(LastBootEntry->TextDevicePath);
+  if (TextDevicePath == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  DevicePath = gEfiDevicePathFromTextProtocol->ConvertTextToDevicePath(TextDevicePath);
+  FreePool(TextDevicePath);
+  if (DevicePath == NULL)
+    return EFI_NOT_FOUND;
+
+  // the device path has to match exactly, not just a parent of it
+  RemainingDevicePath = DevicePath;
+  Status = gBS->LocateDevicePath (Protocol, &RemainingDevicePath, Handle);
+  if (!EFI_ERROR (Status) && !IsDevicePathEnd(RemainingDevicePath))
+    Status = EFI_NOT_FOUND;
+  FreePool(DevicePath);
+  if (EFI_ERROR (Status))
+    return Status;
+
+  return gBS->HandleProtocol (*Handle, Protocol, Interface);
+}
+
+STATIC
+EFI_STATUS
+LastBootEntryBootMultiboot (
+  IN EFI_HANDLE           Handle,
+  IN EFI_FILE_PROTOCOL    *Root,
+  IN BOOLEAN              DisablePatching,
+  IN BOOLEAN              IsRecovery,
+  IN LAST_BOOT_ENTRY      *LastBootEntry
+)
+{
+  EFI_STATUS              Status;
+  EFI_FILE_PROTOCOL       *FileMultibootIni = NULL;
+  EFI_FILE_PROTOCOL       *BootFile = NULL;
+  multiboot_handle_t      *mbhandle = NULL;
+  CHAR16                  *IniPath;
+  CHAR16                  *Separator;
+  PARTITION_LIST_ITEM     *BootPartition;
+
+  IniPath = Ascii2Unicode(LastBootEntry->FilePathName);
+  if (IniPath == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  // open multiboot.ini
+  Status = Root->Open (Root, &FileMultibootIni, IniPath, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR (Status)) {
+    goto CLEANUP;
+  }
+
+  // allocate multiboot handle
+  mbhandle = AllocateZeroPool(sizeof(multiboot_handle_t));
+  if (mbhandle == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto CLEANUP;
+  }
+  InitializeListHead(&mbhandle->Partitions);
+  mbhandle->DeviceHandle = Handle;
+
+  // the ROM directory is the one multiboot.ini is in
+  Separator = StrStr(IniPath, L"\\multiboot.ini");
+  if (Separator == NULL) {
+    Status = EFI_NOT_FOUND;
+    goto CLEANUP;
+  }
+  *Separator = L'\0';
+  Status = Root->Open (Root, &mbhandle->ROMDirectory, IniPath, EFI_FILE_MODE_READ, 0);
+  *Separator = L'\\';
+  if (EFI_ERROR (Status)) {
+    goto CLEANUP;
+  }
+
+  // parse ini
+  IniParseEfiFile(FileMultibootIni, IniHandler, mbhandle);
+  mbhandle->IniParsed = TRUE;
+
+  // store as ascii string
+  PathToUnix(IniPath);
+  mbhandle->MultibootConfig = Unicode2Ascii(IniPath);
+  if (mbhandle->MultibootConfig == NULL) {
+    Status = EFI_OUT_OF_RESOURCES;
+    goto CLEANUP;
+  }
+
+  // open boot file
+  BootPartition = LoaderGetPartitionItem(mbhandle, L"boot");
+  if (BootPartition == NULL) {
+    Status = EFI_NOT_FOUND;
+    goto CLEANUP;
+  }
+  Status = mbhandle->ROMDirectory->Open (
+                   mbhandle->ROMDirectory,
+                   &BootFile,
+                   BootPartition->Value,
+                   EFI_FILE_MODE_READ,
+                   0
+                   );
+  if (EFI_ERROR (Status)) {
+    goto CLEANUP;
+  }
+
+  Status = LoaderBootFromFile(BootFile, mbhandle, DisablePatching, IsRecovery, LastBootEntry);
+
+CLEANUP:
+  FileHandleClose(BootFile);
+  FileHandleClose(FileMultibootIni);
+  FreeMbHandle(mbhandle);
+  FreePool(IniPath);
+
+  return Status;
+}
+
+//
+// boot the last entry without scanning all devices first.
+// only returns if the entry doesn't exist anymore, doesn't say how it
+// was booted or booting failed
+//
+EFI_STATUS
+AndroidLocatorBootLastBootEntry (
+  LAST_BOOT_ENTRY *LastBootEntry
+)
+{
+  EFI_STATUS                        Status;
+  EFI_HANDLE                        Handle;
+  EFI_BLOCK_IO_PROTOCOL             *BlockIo;
+  EFI_SIMPLE_FILE_SYSTEM_PROTOCOL   *Volume;
+  EFI_FILE_PROTOCOL                 *Root = NULL;
+  EFI_FILE_PROTOCOL                 *BootFile = NULL;
+  CHAR16                            *FilePath;
+  BOOLEAN                           DisablePatching;
+  BOOLEAN                           IsRecovery;
+
+  // leave entries we can't boot the same way to the menu
+  if (!(LastBootEntry->Flags & LAST_BOOT_FLAG_VALID) || (LastBootEntry->Flags & LAST_BOOT_FLAG_INDIRECT))
+    return EFI_UNSUPPORTED;
+  DisablePatching = !!(LastBootEntry->Flags & LAST_BOOT_FLAG_DISABLE_PATCHING);
+  IsRecovery = !!(LastBootEntry->Flags & LAST_BOOT_FLAG_RECOVERY);
+
+  if (LastBootEntry->Type == LAST_BOOT_TYPE_BLOCKIO) {
+    Status = LastBootEntryLocate(LastBootEntry, &gEfiBlockIoProtocolGuid, &Handle, (VOID **)&BlockIo);
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+
+    return LoaderBootFromBlockIo(BlockIo, NULL, DisablePatching, IsRecovery, LastBootEntry);
+  }
+
+  Status = LastBootEntryLocate(LastBootEntry, &gEfiSimpleFileSystemProtocolGuid, &Handle, (VOID **)&Volume);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  Status = Volume->OpenVolume (Volume, &Root);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  if (LastBootEntry->Type == LAST_BOOT_TYPE_MULTIBOOT) {
+    Status = LastBootEntryBootMultiboot(Handle, Root, DisablePatching, IsRecovery, LastBootEntry);
+  }
+  else if (LastBootEntry->Type == LAST_BOOT_TYPE_FILE) {
+    FilePath = Ascii2Unicode(LastBootEntry->FilePathName);
+    if (FilePath == NULL) {
+      Status = EFI_OUT_OF_RESOURCES;
+    }
+    else {
+      Status = Root->Open (Root, &BootFile, FilePath, EFI_FILE_MODE_READ, 0);
+      FreePool(FilePath);
+      if (!EFI_ERROR (Status)) {
+        Status = LoaderBootFromFile(BootFile, NULL, DisablePatching, IsRecovery, LastBootEntry);
+        FileHandleClose(BootFile);
+      }
+    }
+  }
+  else {
+    Status = EFI_UNSUPPORTED;
+  }
+
+  FileHandleClose(Root);
+
+  return Status;
+}
@@ -121,6 +121,17 @@ FastbootStartCallback (
 )
 {
   multiboot_handle_t *mbhandle = This->Private;
+  EFI_STATUS         Status;
+
+  // flashing needs the partition list
+  Status = AndroidLocatorLoadMultibootHandle(mbhandle);
+  if (EFI_ERROR (Status)) {
+    CHAR8 Buf[100];
+    AsciiSPrint(Buf, sizeof(Buf), "Can't load multiboot.ini: %r", Status);
+    MenuShowMessage("Error", Buf);
+    return Status;
+  }
+
   gFastbootMBHandle = mbhandle;
   FastbootInit();
   return EFI_SUCCESS;
@@ -261,6 +272,40 @@ MainMenuUpdateUi (
   return EFI_SUCCESS;
 }
 
+#if defined (MDE_CPU_ARM)
+//
+// count down before booting the last entry.
+// returns FALSE if a key was pressed
+//
+STATIC
+BOOLEAN
+AutobootCountdown (
+  UINTN Timeout
+)
+{
+  EFI_INPUT_KEY Key;
+  UINTN         Remaining;
+  UINTN         Tick;
+  CHAR8         Buf[100];
+
+  for (Remaining = Timeout; Remaining > 0; Remaining--) {
+    AsciiSPrint(Buf, sizeof(Buf), "Booting in %us, press any key for the menu", Remaining);
+    MenuShowProgressDialog(Buf, FALSE);
+
+    // poll the keys every 100ms
+    for (Tick = 0; Tick < 10; Tick++) {
+      if (!EFI_ERROR (gBS->CheckEvent (gST->ConIn->WaitForKey))) {
+        gST->ConIn->ReadKeyStroke (gST->ConIn, &Key);
+        return FALSE;
+      }
+      gBS->Stall(100*1000);
+    }
+  }
+
+  return TRUE;
+}
+#endif
+
 INT32
 main (
   IN INT32  Argc,
@@ -312,6 +357,8 @@ main (
     SettingBoolSet("ui-show-fastboot", TRUE);
   if(!UtilVariableExists(L"ui-autoselect-last-boot", &gEFIDroidVariableGuid))
     SettingBoolSet("ui-autoselect-last-boot", FALSE);
+  if(!UtilVariableExists(L"ui-autoboot-timeout", &gEFIDroidVariableGuid))
+    UtilSetEFIDroidVariable("ui-autoboot-timeout", "0");
   if(!UtilVariableExists(L"boot-force-permissive", &gEFIDroidVariableGuid))
     SettingBoolSet("boot-force-permissive", FALSE);
 
@@ -342,9 +389,53 @@ main (
   mBootMenuMain->ActionCallback = MainMenuActionCallback;
   mBootMenuMain->ItemFlags = MENU_ITEM_FLAG_SEPARATOR_ALIGN_TEXT;
 
+  // show previous boot error
+  CHAR8* EFIDroidErrorStr = UtilGetEFIDroidVariable("EFIDroidErrorStr");
+  BOOLEAN PreviousBootFailed = (EFIDroidErrorStr != NULL);
+  if (EFIDroidErrorStr != NULL) {
+    MenuShowMessage("Previous boot failed", EFIDroidErrorStr);
+
+    // delete variable
+    UtilSetEFIDroidVariable("EFIDroidErrorStr", NULL);
+
+    // backup variable
+    UtilSetEFIDroidVariable("EFIDroidErrorStrPrev", EFIDroidErrorStr);
+
+    // free pool
+    FreePool(EFIDroidErrorStr);
+  }
+
+  // get last boot entry, the ones older versions saved are smaller and get dropped
+  LAST_BOOT_ENTRY* LastBootEntry = NULL;
+  UINTN LastBootEntrySize = 0;
+  if (gRT->GetVariable (L"LastBootEntry", &gEFIDroidVariableDataGuid, NULL, &LastBootEntrySize, NULL) == EFI_BUFFER_TOO_SMALL) {
+    if (LastBootEntrySize == sizeof(LAST_BOOT_ENTRY))
+      LastBootEntry = UtilGetEFIDroidDataVariable(L"LastBootEntry");
+    UtilSetEFIDroidDataVariable(L"LastBootEntry", NULL, 0);
+  }
+
 #if defined (MDE_CPU_ARM)
+  BOOLEAN IsRecoveryMode = FALSE;
+  if (mLKApi) {
+    IsRecoveryMode = !AsciiStrCmp(mLKApi->platform_get_uefi_bootpart(), "recovery") || mLKApi->platform_get_uefi_bootmode()==LKAPI_UEFI_BM_RECOVERY;
+  }
+
   // add android options
   AndroidLocatorInit();
+
+  // boot the last entry directly, the full scan only runs if that gets aborted or fails
+  CHAR8* AutobootTimeout = UtilGetEFIDroidVariable("ui-autoboot-timeout");
+  if (AutobootTimeout) {
+    UINTN Timeout = AsciiStrDecimalToUintn(AutobootTimeout);
+    FreePool(AutobootTimeout);
+
+    if (Timeout && LastBootEntry && !IsRecoveryMode && !PreviousBootFailed) {
+      if (AutobootCountdown(Timeout)) {
+        AndroidLocatorBootLastBootEntry(LastBootEntry);
+      }
+    }
+  }
+
   AndroidLocatorAddItems();
 #endif
 
@@ -419,39 +510,17 @@ main (
   Entry->Private = UnicodeStrDup(L"download");
   MenuAddEntry(mPowerMenu, Entry);
 
-  // show previous boot error
-  CHAR8* EFIDroidErrorStr = UtilGetEFIDroidVariable("EFIDroidErrorStr");
-  if (EFIDroidErrorStr != NULL) {
-    MenuShowMessage("Previous boot failed", EFIDroidErrorStr);
-
-    // delete variable
-    UtilSetEFIDroidVariable("EFIDroidErrorStr", NULL);
-
-    // backup variable
-    UtilSetEFIDroidVariable("EFIDroidErrorStrPrev", EFIDroidErrorStr);
-
-    // free pool
-    FreePool(EFIDroidErrorStr);
-  }
-
-  // get last boot entry
-  LAST_BOOT_ENTRY* LastBootEntry = UtilGetEFIDroidDataVariable(L"LastBootEntry");
-  if(LastBootEntry)
-   UtilSetEFIDroidDataVariable(L"LastBootEntry", NULL, 0);
-
 #if defined (MDE_CPU_ARM)
   // run recovery mode handler
-  if (mLKApi) {
-    if(!AsciiStrCmp(mLKApi->platform_get_uefi_bootpart(), "recovery") || mLKApi->platform_get_uefi_bootmode()==LKAPI_UEFI_BM_RECOVERY) {
-      AndroidLocatorHandleRecoveryMode(LastBootEntry);
-    }
+  if (IsRecoveryMode) {
+    AndroidLocatorHandleRecoveryMode(LastBootEntry);
   }
-#endif
 
   // select last booted entry
   if (SettingBoolGet("ui-autoselect-last-boot")) {
-    mBootMenuMain->Selection = GetMenuIdFromLastBootEntry(mBootMenuMain, LastBootEntry);
+    mBootMenuMain->Selection = AndroidLocatorGetMenuIdFromLastBootEntry(mBootMenuMain, LastBootEntry);
   }
+#endif
 
   // free last boot entry
   if(LastBootEntry)
@@ -5,6 +5,8 @@
 #include <LittleKernel.h>
 
 #include <Protocol/BlockIo.h>
+#include <Protocol/BlockIo2.h>
+#include <Protocol/EraseBlock.h>
 #include <Protocol/RamDisk.h>
 #include <Protocol/PartitionName.h>
 #include <Protocol/DevicePathFromText.h>
@@ -17,6 +19,7 @@
 #include <Library/UefiBootManagerLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/CacheMaintenanceLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 
@@ -32,6 +35,7 @@
 #include <lib/boot.h>
 
 #include <Internal/Fastboot.h>
+#include <Internal/Sparse.h>
 #include <Internal/Loader.h>
 #include <Internal/AndroidLocator.h>
 
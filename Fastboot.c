@@ -13,6 +13,12 @@ struct _FASTBOOT_COMMAND {
   CONST CHAR8 *Prefix;
   UINT32 PrefixLen;
   VOID (*Handle)(CHAR8 *Arg, VOID *Data, UINT32 Size);
+
+  // statistics
+  UINT64 Count;
+  UINT64 TotalTime;
+  UINT64 MaxTime;
+  UINT64 Bytes;
 };
 
 typedef struct _FASTBOOT_VAR FASTBOOT_VAR;
@@ -29,8 +35,16 @@ STATIC UINT32 mFastbootState = STATE_OFFLINE;
 STATIC VOID *DownloadBase = NULL;
 STATIC UINT32 DownloadSize = 0;
 STATIC UINTN DownloadPages = 0;
+STATIC VOID *mStagedData = NULL;
+STATIC UINTN mStagedSize = 0;
 STATIC FASTBOOT_COMMAND *CommandList;
+STATIC FASTBOOT_COMMAND **mCommandTable = NULL;
+STATIC UINTN mCommandTableSize = 0;
+STATIC BOOLEAN mCommandTableDirty = TRUE;
+STATIC UINT64 mBytesMoved = 0;
 STATIC FASTBOOT_VAR *VariableList;
+STATIC FASTBOOT_DOWNLOAD_HANDLER *mDownloadHandler = NULL;
+STATIC BOOLEAN mDecompressNextDownload = FALSE;
 
 STATIC VOID
 FastbootNotify (
@@ -115,14 +129,236 @@ FastbootRegister (
 {
   FASTBOOT_COMMAND *Command;
 
-  Command = AllocatePool(sizeof(*Command));
+  // FastbootInit registers its commands every time it runs
+  for (Command = CommandList; Command; Command = Command->Next) {
+    if (!AsciiStrCmp(Command->Prefix, Prefix)) {
+      Command->Handle = Handle;
+      return;
+    }
+  }
+
+  Command = AllocateZeroPool(sizeof(*Command));
   if (Command) {
     Command->Prefix = Prefix;
     Command->PrefixLen = AsciiStrLen(Prefix);
     Command->Handle = Handle;
     Command->Next = CommandList;
     CommandList = Command;
+    mCommandTableDirty = TRUE;
+  }
+}
+
+//
+// builds a table of all commands sorted by their prefix
+//
+STATIC EFI_STATUS
+FastbootBuildCommandTable (
+  VOID
+)
+{
+  FASTBOOT_COMMAND *Command;
+  UINTN            Count;
+  UINTN            Index;
+
+  if (mCommandTable) {
+    FreePool(mCommandTable);
+    mCommandTable = NULL;
+    mCommandTableSize = 0;
+  }
+
+  Count = 0;
+  for (Command = CommandList; Command; Command = Command->Next)
+    Count++;
+
+  mCommandTable = AllocatePool(Count * sizeof(*mCommandTable));
+  if (mCommandTable == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  // insertion sort, we only have a few dozen commands
+  for (Command = CommandList; Command; Command = Command->Next) {
+    for (Index = mCommandTableSize; Index > 0; Index--) {
+      if (AsciiStrCmp(mCommandTable[Index-1]->Prefix, Command->Prefix) <= 0)
+        break;
+      mCommandTable[Index] = mCommandTable[Index-1];
+    }
+    mCommandTable[Index] = Command;
+    mCommandTableSize++;
+  }
+
+  mCommandTableDirty = FALSE;
+  return EFI_SUCCESS;
+}
+
+STATIC FASTBOOT_COMMAND *
+FastbootFindCommandExact (
+  IN CONST CHAR8 *Name,
+  IN UINTN       Len
+)
+{
+  UINTN            Low;
+  UINTN            High;
+  UINTN            Mid;
+  INTN             Result;
+  FASTBOOT_COMMAND *Command;
+
+  Low = 0;
+  High = mCommandTableSize;
+  while (Low < High) {
+    Mid = Low + (High - Low) / 2;
+    Command = mCommandTable[Mid];
+
+    Result = AsciiStrnCmp(Command->Prefix, Name, Len);
+    if (Result == 0 && Command->Prefix[Len])
+      Result = 1;
+
+    if (Result == 0)
+      return Command;
+    if (Result < 0)
+      Low = Mid + 1;
+    else
+      High = Mid;
+  }
+
+  return NULL;
+}
+
+//
+// A prefix matches if it's followed by the end of the command or a space,
+// or if it ends with a colon. So the only candidates are the whole command
+// and the parts ending before a space or after a colon, longest first.
+//
+STATIC FASTBOOT_COMMAND *
+FastbootFindCommand (
+  IN CONST CHAR8 *Buffer,
+  IN UINTN       CmdLen
+)
+{
+  FASTBOOT_COMMAND *Command;
+  UINTN            Len;
+
+  if (mCommandTableDirty && EFI_ERROR(FastbootBuildCommandTable()))
+    return NULL;
+
+  for (Len = CmdLen; Len > 0; Len--) {
+    if (Len != CmdLen && Buffer[Len] != ' ' && Buffer[Len-1] != ':')
+      continue;
+
+    Command = FastbootFindCommandExact(Buffer, Len);
+    if (Command)
+      return Command;
+  }
+
+  return NULL;
+}
+
+STATIC VOID
+FastbootPrintStats (
+  VOID
+)
+{
+  UINTN            Index;
+  FASTBOOT_COMMAND *Command;
+  CHAR8            Response[FASTBOOT_COMMAND_MAX_LENGTH];
+
+  if (mCommandTableDirty && EFI_ERROR(FastbootBuildCommandTable()))
+    return;
+
+  // count, total ms, max ms, KB moved
+  for (Index = 0; Index < mCommandTableSize; Index++) {
+    Command = mCommandTable[Index];
+    if (Command->Count == 0)
+      continue;
+
+    AsciiSPrint(Response, sizeof(Response), "%a: %lux %lu/%lums %luKB",
+      Command->Prefix, Command->Count,
+      DivU64x32(Command->TotalTime, 1000), DivU64x32(Command->MaxTime, 1000),
+      DivU64x32(Command->Bytes, 1024)
+    );
+    FastbootInfo(Response);
+  }
+
+  // block cache under libboot
+  LOADER_IO_STATS IoStats;
+  LoaderGetIoStats(&IoStats);
+  AsciiSPrint(Response, sizeof(Response), "bootio: %lu/%lu hit/miss %lu readahead",
+    IoStats.Hits, IoStats.Misses, IoStats.ReadAheads
+  );
+  FastbootInfo(Response);
+  AsciiSPrint(Response, sizeof(Response), "bootio: %lu reads %luKB %lu errors",
+    IoStats.RawReads, DivU64x32(IoStats.RawBytes, 1024), IoStats.ReadErrors
+  );
+  FastbootInfo(Response);
+}
+
+STATIC VOID
+CommandStats (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  FASTBOOT_COMMAND *Command;
+
+  if (!AsciiStrCmp(Arg, "reset")) {
+    for (Command = CommandList; Command; Command = Command->Next) {
+      Command->Count = 0;
+      Command->TotalTime = 0;
+      Command->MaxTime = 0;
+      Command->Bytes = 0;
+    }
+    LoaderResetIoStats();
   }
+  else {
+    FastbootPrintStats();
+  }
+
+  FastbootOkay("");
+}
+
+STATIC VOID
+CommandBootProf (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  EFI_STATUS          Status;
+  LOADER_BOOT_PROFILE Profile;
+  UINT32              Phase;
+  UINT32              Next;
+  CHAR8               Response[FASTBOOT_COMMAND_MAX_LENGTH];
+
+  Status = LoaderGetLastBootProfile(&Profile);
+  if (EFI_ERROR(Status)) {
+    AsciiSPrint(Response, sizeof(Response), "no boot profile: %r", Status);
+    FastbootFail(Response);
+    return;
+  }
+
+  // start of each phase and the time until the next one, in us
+  for (Phase = 0; Phase < LOADER_BOOT_PHASE_MAX; Phase++) {
+    if (!(Profile.Reached & (1 << Phase)))
+      continue;
+
+    for (Next = Phase + 1; Next < LOADER_BOOT_PHASE_MAX; Next++) {
+      if (Profile.Reached & (1 << Next))
+        break;
+    }
+
+    if (Next < LOADER_BOOT_PHASE_MAX) {
+      AsciiSPrint(Response, sizeof(Response), "%a: @%uus %uus",
+        LoaderBootPhaseName(Phase), Profile.Start[Phase], Profile.Start[Next] - Profile.Start[Phase]
+      );
+    }
+    else {
+      AsciiSPrint(Response, sizeof(Response), "%a: @%uus",
+        LoaderBootPhaseName(Phase), Profile.Start[Phase]
+      );
+    }
+    FastbootInfo(Response);
+  }
+
+  FastbootOkay("");
 }
 
 VOID
@@ -155,6 +391,13 @@ CommandGetVar (
 
   All = !AsciiStrCmp("all", Arg);
 
+  // per-command statistics
+  if (!AsciiStrCmp("stats", Arg)) {
+    FastbootPrintStats();
+    FastbootOkay("");
+    return;
+  }
+
   for (Variable = VariableList; Variable; Variable = Variable->Next) {
     if (All) {
       AsciiSPrint(Response, sizeof(Response), "\t%a: [%a]", Variable->Name, Variable->Value);
@@ -219,6 +462,542 @@ HexToUnsigned (
   return n;
 }
 
+VOID
+FastbootProgress (
+  IN CONST CHAR8 *Text,
+  IN UINT64      Done,
+  IN UINT64      Total
+)
+{
+  UINTN Percent;
+  CHAR8 Buf[100];
+
+  Percent = Total ? (UINTN)DivU64x64Remainder(MultU64x32(Done, 100), Total, NULL) : 0;
+
+  AsciiSPrint(Buf, sizeof(Buf), "%a %u%%", Text, Percent);
+  MenuSetStatus(Buf, Percent);
+  MenuUpdateStatus(FALSE);
+}
+
+STATIC VOID
+FastbootFreeDownloadBuffers (
+  IN FASTBOOT_DOWNLOAD *Download
+)
+{
+  UINTN Index;
+
+  for (Index=0; Index<sizeof(Download->Buffers)/sizeof(Download->Buffers[0]); Index++) {
+    if (Download->Buffers[Index]) {
+      FreeAlignedPages(Download->Buffers[Index], EFI_SIZE_TO_PAGES(FASTBOOT_DOWNLOAD_CHUNK_SIZE));
+      Download->Buffers[Index] = NULL;
+    }
+  }
+}
+
+EFI_STATUS
+FastbootDownloadStart (
+  OUT FASTBOOT_DOWNLOAD *Download,
+  IN  UINT32            Length,
+  IN  VOID              *Destination OPTIONAL
+)
+{
+  CHAR8 Response[FASTBOOT_COMMAND_MAX_LENGTH];
+  UINTN Index;
+
+  ZeroMem(Download, sizeof(*Download));
+  Download->Length = Length;
+  Download->Destination = Destination;
+
+  // allocate ping-pong buffers
+  if (Destination == NULL) {
+    for (Index=0; Index<sizeof(Download->Buffers)/sizeof(Download->Buffers[0]); Index++) {
+      Download->Buffers[Index] = AllocateAlignedPages(EFI_SIZE_TO_PAGES(FASTBOOT_DOWNLOAD_CHUNK_SIZE), EFI_PAGE_SIZE);
+      if (Download->Buffers[Index] == NULL) {
+        FastbootFreeDownloadBuffers(Download);
+        return EFI_OUT_OF_RESOURCES;
+      }
+    }
+  }
+
+  // write response
+  AsciiSPrint(Response, FASTBOOT_COMMAND_MAX_LENGTH, "DATA%08x", Length);
+  if(fastboot_gadget.usb_write(&fastboot_gadget, Response, AsciiStrLen(Response))<0) {
+    FastbootFreeDownloadBuffers(Download);
+    mFastbootState = STATE_ERROR;
+    return EFI_DEVICE_ERROR;
+  }
+
+  Download->StartTime = UtilGetTimeUs();
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+FastbootDownloadNext (
+  IN  FASTBOOT_DOWNLOAD *Download,
+  OUT VOID              **Data,
+  OUT UINTN             *Size
+)
+{
+  UINT8  *Buffer;
+  UINT32 ChunkSize;
+  UINT64 ChunkStart;
+  UINT64 ChunkTime;
+  INT32  r;
+
+  if (Download->Received >= Download->Length)
+    return EFI_END_OF_FILE;
+
+  ChunkSize = MIN(Download->Length - Download->Received, FASTBOOT_DOWNLOAD_CHUNK_SIZE);
+  if (Download->Destination)
+    Buffer = Download->Destination + Download->Received;
+  else
+    Buffer = Download->Buffers[Download->ChunkIndex & 1];
+
+  ChunkStart = UtilGetTimeUs();
+
+  // Discard the cache contents of this chunk only.
+  // The other buffer may still be in use by the consumer.
+  InvalidateDataCacheRange(Buffer, ChunkSize);
+
+  // read data
+  r = fastboot_gadget.usb_read(&fastboot_gadget, Buffer, ChunkSize);
+  if ((r < 0) || ((UINT32) r != ChunkSize)) {
+    mFastbootState = STATE_ERROR;
+    return EFI_DEVICE_ERROR;
+  }
+
+  // per-chunk throughput
+  ChunkTime = UtilGetTimeUs() - ChunkStart;
+  DEBUG((EFI_D_VERBOSE, "fastboot: chunk %u: %u bytes in %lu us (%lu KB/s)\n",
+    Download->ChunkIndex, ChunkSize, ChunkTime,
+    ChunkTime ? ((UINT64)ChunkSize * 1000000ULL / 1024ULL) / ChunkTime : 0ULL
+  ));
+  if (ChunkTime > Download->SlowestChunkTime) {
+    Download->SlowestChunkTime = ChunkTime;
+    Download->SlowestChunkIndex = Download->ChunkIndex;
+  }
+
+  Download->Received += ChunkSize;
+  Download->ChunkIndex++;
+  mBytesMoved += ChunkSize;
+
+  FastbootProgress("Downloading", Download->Received, Download->Length);
+
+  *Data = Buffer;
+  *Size = ChunkSize;
+
+  return EFI_SUCCESS;
+}
+
+VOID
+FastbootDownloadFinish (
+  IN FASTBOOT_DOWNLOAD *Download
+)
+{
+  CHAR8  Response[FASTBOOT_COMMAND_MAX_LENGTH];
+  UINT64 Elapsed;
+
+  Elapsed = UtilGetTimeUs() - Download->StartTime;
+
+  FastbootFreeDownloadBuffers(Download);
+
+  if (Download->Received == 0 || Elapsed == 0)
+    return;
+
+  DEBUG((EFI_D_INFO, "fastboot: received %u bytes in %lu us, slowest chunk %u: %lu us\n",
+    Download->Received, Elapsed, Download->SlowestChunkIndex, Download->SlowestChunkTime));
+
+  AsciiSPrint(Response, sizeof(Response), "%lu KB/s, slowest chunk %u: %lu us",
+    ((UINT64)Download->Received * 1000000ULL / 1024ULL) / Elapsed,
+    Download->SlowestChunkIndex, Download->SlowestChunkTime
+  );
+  FastbootInfo(Response);
+}
+
+EFI_STATUS
+FastbootDownloadStream (
+  IN UINT32                 Length,
+  IN VOID                   *Destination OPTIONAL,
+  IN FASTBOOT_DATA_CONSUMER Consumer OPTIONAL,
+  IN VOID                   *Context
+)
+{
+  FASTBOOT_DOWNLOAD Download;
+  EFI_STATUS        Status;
+  EFI_STATUS        ConsumerStatus;
+  VOID              *Data;
+  UINTN             Size;
+  UINT64            Offset;
+
+  Status = FastbootDownloadStart(&Download, Length, Destination);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  ConsumerStatus = EFI_SUCCESS;
+  for (;;) {
+    Offset = Download.Received;
+    Status = FastbootDownloadNext(&Download, &Data, &Size);
+    if (Status == EFI_END_OF_FILE) {
+      Status = EFI_SUCCESS;
+      break;
+    }
+    if (EFI_ERROR(Status))
+      break;
+
+    // keep receiving after consumer errors, the host won't leave the data phase otherwise
+    if (Consumer && !EFI_ERROR(ConsumerStatus))
+      ConsumerStatus = Consumer(Context, Data, Size, Offset);
+  }
+
+  FastbootDownloadFinish(&Download);
+
+  if (EFI_ERROR(Status))
+    return Status;
+
+  return ConsumerStatus;
+}
+
+EFI_STATUS
+FastbootUploadStart (
+  IN UINT32 Length
+)
+{
+  STACKBUF_DMA_ALIGN(Response, FASTBOOT_COMMAND_MAX_LENGTH);
+
+  AsciiSPrint((CHAR8*)Response, FASTBOOT_COMMAND_MAX_LENGTH, "DATA%08x", Length);
+  if(fastboot_gadget.usb_write(&fastboot_gadget, Response, AsciiStrLen((CHAR8*)Response))<0) {
+    mFastbootState = STATE_ERROR;
+    return EFI_DEVICE_ERROR;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+FastbootUploadData (
+  IN VOID  *Data,
+  IN UINTN Size
+)
+{
+  UINT8 *Data8 = Data;
+  UINTN Index;
+  UINTN ChunkSize;
+
+  for (Index=0; Index<Size; Index+=ChunkSize) {
+    ChunkSize = MIN(Size-Index, FASTBOOT_DOWNLOAD_CHUNK_SIZE);
+
+    // make sure the controller sees our data
+    WriteBackDataCacheRange(&Data8[Index], ChunkSize);
+
+    if(fastboot_gadget.usb_write(&fastboot_gadget, &Data8[Index], ChunkSize)<0) {
+      mFastbootState = STATE_ERROR;
+      return EFI_DEVICE_ERROR;
+    }
+    mBytesMoved += ChunkSize;
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC VOID
+FastbootFreeStagedData (
+  VOID
+)
+{
+  if (mStagedData) {
+    FreeAlignedPages(mStagedData, EFI_SIZE_TO_PAGES(mStagedSize));
+    mStagedData = NULL;
+    mStagedSize = 0;
+  }
+}
+
+EFI_STATUS
+FastbootStage (
+  IN CONST VOID *Data,
+  IN UINTN      Size
+)
+{
+  FastbootFreeStagedData();
+
+  if (Size == 0 || Size > MAX_UINT32)
+    return EFI_INVALID_PARAMETER;
+
+  mStagedData = AllocateAlignedPages(EFI_SIZE_TO_PAGES(Size), EFI_PAGE_SIZE);
+  if (mStagedData == NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  CopyMem(mStagedData, Data, Size);
+  mStagedSize = Size;
+
+  return EFI_SUCCESS;
+}
+
+STATIC VOID
+CommandUpload (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  EFI_STATUS Status;
+
+  if (mStagedData == NULL) {
+    FastbootFail("no data staged");
+    return;
+  }
+
+  // send everything in a single data phase
+  Status = FastbootUploadStart((UINT32)mStagedSize);
+  if (!EFI_ERROR(Status))
+    Status = FastbootUploadData(mStagedData, mStagedSize);
+
+  FastbootFreeStagedData();
+
+  if (EFI_ERROR(Status))
+    return;
+
+  FastbootOkay("");
+}
+
+typedef struct {
+  FASTBOOT_DOWNLOAD      Download;
+  EFI_STATUS             DownloadStatus;
+
+  // unread part of the current chunk
+  UINT8                  *Chunk;
+  UINTN                  ChunkLeft;
+
+  // streamed output
+  FASTBOOT_DATA_CONSUMER Consumer;
+  VOID                   *Context;
+  EFI_STATUS             ConsumerStatus;
+
+  // buffered output
+  UINT8                  *Buffer;
+  UINTN                  BufferPages;
+
+  UINT64                 OutputSize;
+  CONST CHAR8            *Error;
+} DECOMPRESS_STATE;
+
+// the decompressor callbacks don't have a context pointer
+STATIC DECOMPRESS_STATE *mDecompressState = NULL;
+
+STATIC long
+DecompressFill (
+  VOID          *Buffer,
+  unsigned long Size
+)
+{
+  DECOMPRESS_STATE *State = mDecompressState;
+  UINT8            *Buffer8 = Buffer;
+  unsigned long    Filled = 0;
+  UINTN            Len;
+  VOID             *Data;
+  EFI_STATUS       Status;
+
+  // some decompressors expect full reads, so fill across chunk boundaries
+  while (Filled < Size) {
+    if (State->ChunkLeft == 0) {
+      Status = FastbootDownloadNext(&State->Download, &Data, &State->ChunkLeft);
+      if (Status == EFI_END_OF_FILE)
+        break;
+      if (EFI_ERROR(Status)) {
+        State->DownloadStatus = Status;
+        return -1;
+      }
+      State->Chunk = Data;
+    }
+
+    Len = MIN(Size - Filled, State->ChunkLeft);
+    CopyMem(Buffer8 + Filled, State->Chunk, Len);
+    State->Chunk += Len;
+    State->ChunkLeft -= Len;
+    Filled += Len;
+  }
+
+  return Filled;
+}
+
+STATIC long
+DecompressFlush (
+  VOID          *Data,
+  unsigned long Size
+)
+{
+  DECOMPRESS_STATE *State = mDecompressState;
+  UINTN            NewPages;
+  UINT8            *NewBuffer;
+
+  if (State->Consumer) {
+    State->ConsumerStatus = State->Consumer(State->Context, Data, Size, State->OutputSize);
+    if (EFI_ERROR(State->ConsumerStatus))
+      return -1;
+  }
+  else {
+    if (State->OutputSize + Size > FASTBOOT_MAX_DOWNLOAD_SIZE) {
+      State->Error = "decompressed data too large";
+      return -1;
+    }
+
+    // grow the output buffer
+    if (State->OutputSize + Size > EFI_PAGES_TO_SIZE(State->BufferPages)) {
+      NewPages = MAX(State->BufferPages * 2, EFI_SIZE_TO_PAGES((UINTN)State->OutputSize + Size));
+      NewBuffer = AllocateAlignedPages(NewPages, EFI_PAGE_SIZE);
+      if (NewBuffer == NULL) {
+        State->Error = "out of memory";
+        return -1;
+      }
+
+      if (State->Buffer) {
+        CopyMem(NewBuffer, State->Buffer, (UINTN)State->OutputSize);
+        FreeAlignedPages(State->Buffer, State->BufferPages);
+      }
+      State->Buffer = NewBuffer;
+      State->BufferPages = NewPages;
+    }
+
+    CopyMem(State->Buffer + State->OutputSize, Data, Size);
+  }
+
+  State->OutputSize += Size;
+  return Size;
+}
+
+STATIC VOID
+DecompressError (
+  char *Message
+)
+{
+  DEBUG((EFI_D_ERROR, "fastboot: decompression error: %a\n", Message));
+  if (mDecompressState && mDecompressState->Error == NULL)
+    mDecompressState->Error = Message;
+}
+
+//
+// receives a compressed download and decompresses it on the fly, either
+// into the consumer or into a buffer which then replaces the download buffer.
+// sends the response.
+//
+STATIC VOID
+FastbootDownloadDecompress (
+  IN UINT32                    Length,
+  IN FASTBOOT_DOWNLOAD_HANDLER *Handler OPTIONAL
+)
+{
+  DECOMPRESS_STATE State;
+  EFI_STATUS       Status;
+  decompress_fn    Decompressor;
+  CONST CHAR8      *Name;
+  VOID             *Data;
+  UINTN            Size;
+  CHAR8            Response[FASTBOOT_COMMAND_MAX_LENGTH];
+
+  ZeroMem(&State, sizeof(State));
+  if (Handler) {
+    State.Consumer = Handler->Consumer;
+    State.Context = Handler->Context;
+  }
+
+  Status = FastbootDownloadStart(&State.Download, Length, NULL);
+  if (EFI_ERROR(Status)) {
+    if (Status == EFI_OUT_OF_RESOURCES)
+      State.Error = "out of memory";
+    State.DownloadStatus = Status;
+    goto Done;
+  }
+
+  // sniff the compression format
+  Status = FastbootDownloadNext(&State.Download, &Data, &State.ChunkLeft);
+  if (EFI_ERROR(Status)) {
+    if (Status != EFI_END_OF_FILE)
+      State.DownloadStatus = Status;
+    goto Finish;
+  }
+  State.Chunk = Data;
+
+  Decompressor = decompress_method(State.Chunk, State.ChunkLeft, &Name);
+  if (Decompressor == NULL) {
+    State.Error = "unknown compression format";
+    goto Finish;
+  }
+
+  AsciiSPrint(Response, sizeof(Response), "decompressing %a data", Name);
+  FastbootInfo(Response);
+
+  mDecompressState = &State;
+  if (Decompressor(NULL, 0, DecompressFill, DecompressFlush, NULL, NULL, DecompressError) && State.Error == NULL)
+    State.Error = "decompression failed";
+  mDecompressState = NULL;
+
+Finish:
+  // drain the rest, the host won't leave the data phase otherwise
+  while (!EFI_ERROR(State.DownloadStatus)) {
+    Status = FastbootDownloadNext(&State.Download, &Data, &Size);
+    if (Status == EFI_END_OF_FILE)
+      break;
+    if (EFI_ERROR(Status))
+      State.DownloadStatus = Status;
+  }
+
+  FastbootDownloadFinish(&State.Download);
+
+Done:
+  if (EFI_ERROR(State.DownloadStatus))
+    Status = State.DownloadStatus;
+  else if (EFI_ERROR(State.ConsumerStatus))
+    Status = State.ConsumerStatus;
+  else if (State.Error)
+    Status = EFI_COMPRESSED_DATA_CORRUPT;
+  else
+    Status = EFI_SUCCESS;
+
+  if (Handler) {
+    if (State.Error && Status == EFI_COMPRESSED_DATA_CORRUPT)
+      FastbootInfo(State.Error);
+    Handler->Finish(Handler->Context, Status);
+    return;
+  }
+
+  if (EFI_ERROR(Status)) {
+    if (State.Buffer)
+      FreeAlignedPages(State.Buffer, State.BufferPages);
+    FastbootFail(State.Error ? State.Error : "decompression failed");
+    return;
+  }
+
+  // the decompressed data becomes the download buffer
+  DownloadBase = State.Buffer;
+  DownloadPages = State.BufferPages;
+  DownloadSize = (UINT32)State.OutputSize;
+
+  AsciiSPrint(Response, sizeof(Response), "decompressed to %lu bytes", State.OutputSize);
+  FastbootInfo(Response);
+  FastbootOkay("");
+}
+
+STATIC VOID
+CommandDecompress (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  mDecompressNextDownload = TRUE;
+
+  FastbootInfo("the next download will be decompressed");
+  FastbootOkay("");
+}
+
+VOID
+FastbootSetDownloadHandler (
+  IN FASTBOOT_DOWNLOAD_HANDLER *Handler OPTIONAL
+)
+{
+  mDownloadHandler = Handler;
+}
+
 STATIC VOID
 CommandDownload (
   CHAR8 *Arg,
@@ -226,9 +1005,9 @@ CommandDownload (
   UINT32 Size
 )
 {
-  CHAR8 Response[FASTBOOT_COMMAND_MAX_LENGTH];
   UINT32 Length = HexToUnsigned(Arg);
-  INT32 r;
+  EFI_STATUS Status;
+  FASTBOOT_DOWNLOAD_HANDLER *Handler;
 
   // free old data
   if(DownloadBase) {
@@ -238,6 +1017,32 @@ CommandDownload (
     DownloadPages = 0;
   }
 
+  // decompress on the fly
+  if (mDecompressNextDownload) {
+    mDecompressNextDownload = FALSE;
+
+    Handler = mDownloadHandler;
+    mDownloadHandler = NULL;
+
+    FastbootDownloadDecompress(Length, Handler);
+    return;
+  }
+
+  // stream to the armed handler instead of buffering the data
+  if (mDownloadHandler) {
+    Handler = mDownloadHandler;
+    mDownloadHandler = NULL;
+
+    Status = FastbootDownloadStream(Length, NULL, Handler->Consumer, Handler->Context);
+    Handler->Finish(Handler->Context, Status);
+    return;
+  }
+
+  if (Length > FASTBOOT_MAX_DOWNLOAD_SIZE) {
+    FastbootFail("data too large");
+    return;
+  }
+
   // allocate data buffer
   DownloadSize = 0;
   DownloadPages = ROUNDUP(Length, EFI_PAGE_SIZE)/EFI_PAGE_SIZE;
@@ -247,20 +1052,9 @@ CommandDownload (
     return;
   }
 
-  // write response
-  AsciiSPrint(Response, FASTBOOT_COMMAND_MAX_LENGTH, "DATA%08x", Length);
-  if(fastboot_gadget.usb_write(&fastboot_gadget, Response, AsciiStrLen(Response))<0) {
-    mFastbootState = STATE_ERROR;
-    return;
-  }
-
-  // Discard the cache contents before starting the download
-  InvalidateDataCacheRange(DownloadBase, Length);
-
-  // read data
-  r = fastboot_gadget.usb_read(&fastboot_gadget, DownloadBase, Length);
-  if ((r < 0) || ((UINT32) r != Length)) {
-    mFastbootState = STATE_ERROR;
+  // receive data in chunks, straight into the download buffer
+  Status = FastbootDownloadStream(Length, DownloadBase, NULL, NULL);
+  if (EFI_ERROR(Status)) {
     return;
   }
 
@@ -277,6 +1071,9 @@ FastbootCommandLoop (
 {
   INT32 r;
   FASTBOOT_COMMAND *Command;
+  UINT64 StartTime;
+  UINT64 StartBytes;
+  UINT64 Elapsed;
   DEBUG((EFI_D_INFO, "fastboot: processing commands\n"));
 
   UINT8* Buffer = AllocateAlignedPages(ArmDataCacheLineLength(), ROUNDUP(4096, ArmDataCacheLineLength()));
@@ -287,7 +1084,9 @@ FastbootCommandLoop (
     SetMem(Buffer, FASTBOOT_COMMAND_MAX_LENGTH, 0);
     InvalidateDataCacheRange(Buffer, FASTBOOT_COMMAND_MAX_LENGTH);
 
-    MenuShowProgressDialog("Waiting for commands", FALSE);
+    // this only renders if a command changed the status
+    MenuSetStatus("Waiting for commands", MENU_PROGRESS_NONE);
+    MenuUpdateStatus(TRUE);
 
     r = fastboot_gadget.usb_read(&fastboot_gadget, Buffer, FASTBOOT_COMMAND_MAX_LENGTH);
     if (r < 0) break;
@@ -297,28 +1096,28 @@ FastbootCommandLoop (
 
     mFastbootState = STATE_COMMAND;
 
-    for (Command = CommandList; Command; Command = Command->Next) {
-      UINTN CmdLen = AsciiStrLen((CHAR8*)Buffer);
-
-      if (CompareMem(Buffer, Command->Prefix, Command->PrefixLen))
-        continue;
-
-      if (CmdLen>Command->PrefixLen && Buffer[Command->PrefixLen]!=' ' && Buffer[Command->PrefixLen-1]!=':')
-		continue;
-
+    Command = FastbootFindCommand((CHAR8*)Buffer, AsciiStrLen((CHAR8*)Buffer));
+    if (Command) {
       CHAR8* Arg = (CHAR8*) Buffer + Command->PrefixLen;
       if(Arg[0]==' ')
         Arg++;
 
+      StartTime = UtilGetTimeUs();
+      StartBytes = mBytesMoved;
+
       Command->Handle(Arg, DownloadBase, DownloadSize);
+
+      Elapsed = UtilGetTimeUs() - StartTime;
+      Command->Count++;
+      Command->TotalTime += Elapsed;
+      Command->MaxTime = MAX(Command->MaxTime, Elapsed);
+      Command->Bytes += mBytesMoved - StartBytes;
+
       if (mFastbootState == STATE_STOP)
         goto STOP;
       if (mFastbootState == STATE_COMMAND)
         FastbootFail("unknown reason");
 
-      RenderActiveMenu();
-      MenuDrawDarkBackground();
-
       goto AGAIN;
     }
 
@@ -334,12 +1133,21 @@ STOP:
   }
   FreeAlignedPages(Buffer, 1);
 
+  // cancel pending streams
+  mDecompressNextDownload = FALSE;
+  if (mDownloadHandler) {
+    mDownloadHandler->Finish(mDownloadHandler->Context, EFI_ABORTED);
+    mDownloadHandler = NULL;
+  }
+
   if (DownloadBase!=NULL) {
     FreeAlignedPages(DownloadBase, DownloadPages);
     DownloadBase = NULL;
     DownloadSize = 0;
     DownloadPages = 0;
   }
+
+  FastbootFreeStagedData();
 }
 
 STATIC
@@ -354,6 +1162,9 @@ FastbootHandler (
     MenuShowProgressDialog("Connect USB Cable", FALSE);
     gBS->WaitForEvent (1, &mUsbOnlineEvent, &EventIndex);
 
+    // make sure the status dialog replaces this one
+    MenuInvalidateStatus();
+
     FastbootCommandLoop();
     if (mFastbootState==STATE_STOP || mFastbootState==STATE_STOPPED)
       break;
@@ -391,10 +1202,14 @@ FastbootInit (
   FastbootRegister("oem help", CommandHelp);
   FastbootRegister("getvar:", CommandGetVar);
   FastbootRegister("download:", CommandDownload);
+  FastbootRegister("upload", CommandUpload);
+  FastbootRegister("oem decompress", CommandDecompress);
+  FastbootRegister("oem stats", CommandStats);
+  FastbootRegister("oem bootprof", CommandBootProf);
   FastbootPublish("version", "0.5");
 
-  // we use dynamic allocations, so report the highest possible value
-  FastbootPublish("max-download-size", "0xffffffff");
+  // downloads are buffered in RAM, larger images have to be sent in sparse chunks or streamed
+  FastbootPublish("max-download-size", FASTBOOT_MAX_DOWNLOAD_SIZE_STR);
 
   surf_udc_device.serialno = AsciiStrDup("EFIDroid");
   r = mUsbInterface->udc_init(mUsbInterface, &surf_udc_device);
@@ -192,6 +192,9 @@ CommandShell (
   gST->StdErr->OutputString = mErrOutputStringOrig;
   gST->ConOut->OutputString = mOutputStringOrig;
 
+  // the application may have drawn over the fastboot UI
+  MenuInvalidateStatus();
+
   // print status
   if(EFI_ERROR(Status)) {
     AsciiSPrint(Buffer, 59, "Error: %r", Status);
@@ -347,7 +350,12 @@ CommandScreenShot (
       if(Index!=ScreenShotIndex)
         continue;
 
-      FastbootSendBuf(ScreenShot->Data, ScreenShot->Len);
+      if (EFI_ERROR(FastbootStage(ScreenShot->Data, ScreenShot->Len))) {
+        FastbootFail("can't stage screenshot");
+        return;
+      }
+
+      FastbootInfo("use 'fastboot get_staged <file>' to download it");
       FastbootOkay("");
 
       return;
@@ -357,11 +365,20 @@ CommandScreenShot (
   }
 }
 
+typedef struct {
+  CONST CHAR16 *Name;
+
+  // dump of all variables
+  CHAR8        *Buffer;
+  UINTN        BufferSize;
+  UINTN        BufferUsed;
+} GETNVVAR_CONTEXT;
+
 STATIC
 RETURN_STATUS
 EFIAPI
 IterateVariablesCallbackPrint (
-  IN  VOID                         *Context,
+  IN  VOID                         *VoidContext,
   IN  CHAR16                       *VariableName,
   IN  EFI_GUID                     *VendorGuid,
   IN  UINT32                       Attributes,
@@ -370,28 +387,47 @@ IterateVariablesCallbackPrint (
   )
 {
   EFI_STATUS          Status;
-  CONST CHAR16        *Arg;
+  GETNVVAR_CONTEXT    *Context;
 
   Status = EFI_SUCCESS;
-  Arg = Context;
+  Context = VoidContext;
 
   // show our variables only
   if (!CompareGuid(VendorGuid, &gEFIDroidVariableGuid))
     return Status;
 
   // show specific variable only
-  if (Arg && StrCmp(VariableName, Arg))
+  if (Context->Name && StrCmp(VariableName, Context->Name))
     return Status;
 
   UINTN BufSize = StrLen(VariableName) + DataSize + 10 + 1;
-  CHAR8 *Buf = AllocatePool(BufSize);
-  if (Buf == NULL)
-    return EFI_OUT_OF_RESOURCES;
 
-  AsciiSPrint(Buf, BufSize, "%s: %a\n", VariableName, (CONST CHAR8*)Data);
-  FastbootSendString(Buf, AsciiStrLen(Buf));
+  // specific variables are small enough for INFO responses
+  if (Context->Name) {
+    CHAR8 *Buf = AllocatePool(BufSize);
+    if (Buf == NULL)
+      return EFI_OUT_OF_RESOURCES;
+
+    AsciiSPrint(Buf, BufSize, "%s: %a\n", VariableName, (CONST CHAR8*)Data);
+    FastbootSendString(Buf, AsciiStrLen(Buf));
+
+    FreePool(Buf);
+    return Status;
+  }
 
-  FreePool(Buf);
+  // grow dump buffer
+  if (Context->BufferUsed + BufSize > Context->BufferSize) {
+    UINTN NewSize = MAX(Context->BufferSize * 2, Context->BufferUsed + BufSize);
+    CHAR8 *NewBuffer = ReallocatePool(Context->BufferSize, NewSize, Context->Buffer);
+    if (NewBuffer == NULL)
+      return EFI_OUT_OF_RESOURCES;
+
+    Context->Buffer = NewBuffer;
+    Context->BufferSize = NewSize;
+  }
+
+  AsciiSPrint(Context->Buffer + Context->BufferUsed, BufSize, "%s: %a\n", VariableName, (CONST CHAR8*)Data);
+  Context->BufferUsed += AsciiStrLen(Context->Buffer + Context->BufferUsed);
 
   return Status;
 }
@@ -404,9 +440,10 @@ CommandGetNvVar (
   UINT32 Size
 )
 {
-  EFI_STATUS Status;
-  CHAR8      Buf[100];
-  CHAR16     *Arg16;
+  EFI_STATUS       Status;
+  CHAR8            Buf[100];
+  CHAR16           *Arg16;
+  GETNVVAR_CONTEXT Context;
 
   Arg16 = NULL;
   if(AsciiStrLen(Arg)>0) {
@@ -414,11 +451,24 @@ CommandGetNvVar (
     ASSERT(Arg16);
   }
 
-  Status = UtilIterateVariables(IterateVariablesCallbackPrint, Arg16);
+  ZeroMem(&Context, sizeof(Context));
+  Context.Name = Arg16;
+
+  Status = UtilIterateVariables(IterateVariablesCallbackPrint, &Context);
 
   if (Arg16)
     FreePool(Arg16);
 
+  // stage the dump of all variables
+  if (!EFI_ERROR(Status) && Context.BufferUsed > 0) {
+    Status = FastbootStage(Context.Buffer, Context.BufferUsed);
+    if (!EFI_ERROR(Status))
+      FastbootInfo("use 'fastboot get_staged <file>' to download the dump");
+  }
+
+  if (Context.Buffer)
+    FreePool(Context.Buffer);
+
   if(EFI_ERROR(Status)) {
     AsciiSPrint(Buf, sizeof(Buf), "%r", Status);
     FastbootFail(Buf);
@@ -464,45 +514,57 @@ CommandSetNvVar (
   }
 }
 
+// bounce buffer for block device writes, has to be a multiple of the block size
+#define FLASH_BUFFER_SIZE SIZE_1MB
+
 typedef struct {
-  CHAR16       *PartitionName;
-  VOID         *Data;
-  UINTN        DataSize;
+  // exactly one of these is set
+  EFI_BLOCK_IO_PROTOCOL *BlockIo;
+  EFI_FILE_PROTOCOL     *File;
+  EFI_HANDLE            Handle;
 
-  BOOLEAN      Done;
-} FLASH_CONTEXT;
+  // size of the partition and number of bytes written to it
+  UINT64                Size;
+  UINT64                Offset;
+
+  // data which doesn't fill a whole block yet
+  UINT8                 *Buffer;
+  UINTN                 BufferUsed;
+
+  // sparse images are detected on the first write
+  BOOLEAN               Started;
+  BOOLEAN               IsSparse;
+  SPARSE_PARSER         Sparse;
+
+  // pattern buffer for sparse FILL chunks
+  UINT8                 *FillBuffer;
+  UINT32                FillPattern;
+
+  CHAR8                 Error[FASTBOOT_COMMAND_MAX_LENGTH];
+} FLASH_TARGET;
+
+typedef struct {
+  CHAR16                *PartitionName;
+  EFI_BLOCK_IO_PROTOCOL *BlockIo;
+  EFI_HANDLE            Handle;
+} FIND_BLOCKIO_CONTEXT;
 
 STATIC
 EFI_STATUS
-HandleBlockIoFlash (
+FindBlockIoByPartitionName (
   IN EFI_HANDLE  Handle,
   IN VOID        *Instance,
   IN VOID        *VoidContext
   )
 {
   EFI_STATUS                        Status;
-  EFI_BLOCK_IO_PROTOCOL             *BlockIo = NULL;
   EFI_PARTITION_NAME_PROTOCOL       *PartitionNameProtocol = NULL;
-  FLASH_CONTEXT                     *Context;
-  CHAR8                             Buf[100];
+  FIND_BLOCKIO_CONTEXT              *Context;
 
   Context = VoidContext;
-  if(Context->Done)
+  if(Context->BlockIo)
     return EFI_SUCCESS;
 
-  //
-  // Get the BlockIO protocol on that handle
-  //
-  BlockIo = NULL;
-  Status = gBS->HandleProtocol (
-                  Handle,
-                  &gEfiBlockIoProtocolGuid,
-                  (VOID **)&BlockIo
-                  );
-  if (EFI_ERROR (Status)) {
-    return Status;
-  }
-
   //
   // Get the PartitionName protocol on that handle
   //
@@ -519,145 +581,100 @@ HandleBlockIoFlash (
     return EFI_NOT_FOUND;
   }
 
-  Context->Done = TRUE;
-
-  UINTN SizeAligned = ROUNDDOWN(Context->DataSize, BlockIo->Media->BlockSize);
-  UINTN SizeLeft = Context->DataSize - SizeAligned;
-
-  if (SizeAligned>0) {
-    Status = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId, 0, SizeAligned, Context->Data);
-    if (EFI_ERROR(Status)) {
-      AsciiSPrint(Buf, sizeof(Buf), "can't write blocks %r", Status);
-      FastbootFail(Buf);
-      return Status;
-    }
-  }
-
-  if (SizeLeft>0) {
-    UINTN NumTmpBufPages = ROUNDUP(BlockIo->Media->BlockSize, EFI_PAGE_SIZE)/EFI_PAGE_SIZE;
-    VOID *TmpBuf = AllocateAlignedPages(NumTmpBufPages, BlockIo->Media->BlockSize);
-    if (TmpBuf == NULL) {
-      FastbootFail("can't allocate memory");
-      return EFI_OUT_OF_RESOURCES;
-    }
-
-    ZeroMem(TmpBuf, BlockIo->Media->BlockSize);
-    CopyMem(TmpBuf, Context->Data + SizeAligned, SizeLeft);
-
-    Status = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId, SizeAligned, BlockIo->Media->BlockSize, TmpBuf);
-    FreeAlignedPages(TmpBuf, NumTmpBufPages);
-    if (EFI_ERROR(Status)) {
-      AsciiSPrint(Buf, sizeof(Buf), "can't write blocks %r", Status);
-      FastbootFail(Buf);
-      return Status;
-    }
-  }
-
-  FastbootOkay("");
+  Context->BlockIo = Instance;
+  Context->Handle = Handle;
   return EFI_SUCCESS;
 }
 
-VOID
-HandleFileFlash (
-  EFI_FILE_PROTOCOL *File,
-  VOID              *Data,
-  UINTN             DataSize
+STATIC
+EFI_STATUS
+FlashTargetOpenFile (
+  OUT FLASH_TARGET      *Target,
+  IN  EFI_FILE_PROTOCOL *Directory,
+  IN  CHAR16            *FileName,
+  IN  UINT64            OpenMode
 )
 {
-  UINT64     FileSize = 0;
-  EFI_STATUS Status;
-  CHAR8      Buf[100];
-
-  // get file size
-  Status = FileHandleGetSize(File, &FileSize);
-  if (EFI_ERROR (Status)) {
-    AsciiSPrint(Buf, sizeof(Buf), "can't get file size: %r", Status);
+  EFI_FILE_PROTOCOL *PartitionFile = NULL;
+  UINT64            FileSize = 0;
+  EFI_STATUS        Status;
+  CHAR8             Buf[100];
+
+  // open File
+  Status = Directory->Open (
+                   Directory,
+                   &PartitionFile,
+                   FileName,
+                   OpenMode,
+                   0
+                   );
+  if (EFI_ERROR(Status)) {
+    AsciiSPrint(Buf, sizeof(Buf), "can't open replacement partition: %r", Status);
     FastbootFail(Buf);
-    goto Done;
-  }
-
-  // validate size
-  if (DataSize>FileSize) {
-    FastbootFail("data size exceeds partition size");
-    goto Done;
+    return Status;
   }
 
-  // write data
-  UINTN WriteSize = DataSize;
-  Status = FileHandleWrite(File, &WriteSize, Data);
+  // get file size
+  Status = FileHandleGetSize(PartitionFile, &FileSize);
   if (EFI_ERROR (Status)) {
-    AsciiSPrint(Buf, sizeof(Buf), "can't write: %r", Status);
-    FastbootFail(Buf);
-    goto Done;
-  }
-
-  // validate return value
-  if (WriteSize!=DataSize) {
-    AsciiSPrint(Buf, sizeof(Buf), "short write: %u/%u bytes written", WriteSize, DataSize);
+    AsciiSPrint(Buf, sizeof(Buf), "can't get file size: %r", Status);
     FastbootFail(Buf);
-    goto Done;
+    FileHandleClose(PartitionFile);
+    return Status;
   }
 
-  FastbootOkay("");
+  Target->File = PartitionFile;
+  Target->Size = FileSize;
 
-Done:
-  return;
+  return EFI_SUCCESS;
 }
 
+//
+// resolves the partition name the same way for flashes and fetches:
+// multiboot replacement file, ESP replacement file or the real partition.
+// the write buffer and the redirect messages are only for flashes.
+// sends FAIL on errors.
+//
 STATIC
-VOID
-CommandFlash (
-  CHAR8 *Arg,
-  VOID *Data,
-  UINT32 Size
+EFI_STATUS
+FlashTargetOpen (
+  OUT FLASH_TARGET *Target,
+  IN  CHAR8        *Name,
+  IN  UINT64       OpenMode
 )
 {
-  FSTAB              *FsTab;
-  EFI_FILE_PROTOCOL  *EspDir;
-  FLASH_CONTEXT      Context;
-  EFI_STATUS         Status;
-  CHAR8              Buf[100];
+  FSTAB                 *FsTab;
+  EFI_FILE_PROTOCOL     *EspDir;
+  FIND_BLOCKIO_CONTEXT  Context;
+  EFI_STATUS            Status;
+
+  ZeroMem(Target, sizeof(*Target));
 
   if (gFastbootMBHandle) {
     // get partition
-    CHAR16 *NameUnicode = Ascii2Unicode(Arg);
+    CHAR16 *NameUnicode = Ascii2Unicode(Name);
     if (!NameUnicode) {
       FastbootFail("can't allocate memory");
-      return;
+      return EFI_OUT_OF_RESOURCES;
     }
     PARTITION_LIST_ITEM *Item = LoaderGetPartitionItem(gFastbootMBHandle, NameUnicode);
     FreePool(NameUnicode);
     if (!Item) {
       FastbootFail("partition not found");
-      return;
+      return EFI_NOT_FOUND;
     }
     if (!Item->IsFile) {
       FastbootFail("partition is not a file");
-      return;
+      return EFI_UNSUPPORTED;
     }
 
-    // open File
-    EFI_FILE_PROTOCOL *PartitionFile = NULL;
-    Status = gFastbootMBHandle->ROMDirectory->Open (
-                     gFastbootMBHandle->ROMDirectory,
-                     &PartitionFile,
-                     Item->Value,
-                     EFI_FILE_MODE_READ|EFI_FILE_MODE_WRITE,
-                     0
-                     );
-    if (EFI_ERROR(Status)) {
-      AsciiSPrint(Buf, sizeof(Buf), "can't open replacement partition: %r", Status);
-      FastbootFail(Buf);
-      return;
-    }
-
-    // flash
-    FastbootInfo("INFO: redirect flash to Multiboot ROM");
-    HandleFileFlash (PartitionFile, Data, (UINTN)Size);
+    Status = FlashTargetOpenFile(Target, gFastbootMBHandle->ROMDirectory, Item->Value, OpenMode);
+    if (EFI_ERROR(Status))
+      return Status;
 
-    // close
-    FileHandleClose(PartitionFile);
-    return;
+    if (OpenMode & EFI_FILE_MODE_WRITE)
+      FastbootInfo("INFO: redirect flash to Multiboot ROM");
+    return EFI_SUCCESS;
   }
 
   FsTab = AndroidLocatorGetMultibootFsTab ();
@@ -665,18 +682,17 @@ CommandFlash (
   if (FsTab && EspDir) {
     // handle the special uefi prefix
     BOOLEAN IsUefiFlash = FALSE;
-    if (!AsciiStrnCmp(Arg, "uefi_", 5)) {
-      Arg += 5;
+    if (!AsciiStrnCmp(Name, "uefi_", 5)) {
+      Name += 5;
       IsUefiFlash = TRUE;
     }
 
-    FSTAB_REC* Rec = FstabGetByPartitionName(FsTab, Arg);
+    FSTAB_REC* Rec = FstabGetByPartitionName(FsTab, Name);
     if(Rec && FstabIsUEFI(Rec)) {
-      EFI_FILE_PROTOCOL *PartitionFile = NULL;
-
       // this is a uefi partition flash
       if (IsUefiFlash) {
-        FastbootInfo("INFO: flash to UEFI partition");
+        if (OpenMode & EFI_FILE_MODE_WRITE)
+          FastbootInfo("INFO: flash to UEFI partition");
         goto DO_BLOCKIO_FLASH;
       }
 
@@ -686,61 +702,883 @@ CommandFlash (
       ASSERT(PathBuf);
       UnicodeSPrint(PathBuf, PathBufSize, L"partition_%a.img", Rec->mount_point+1);
 
-      // open File
-      Status = EspDir->Open (
-                       EspDir,
-                       &PartitionFile,
-                       PathBuf,
-                       EFI_FILE_MODE_READ|EFI_FILE_MODE_WRITE,
-                       0
-                       );
+      Status = FlashTargetOpenFile(Target, EspDir, PathBuf, OpenMode);
       FreePool(PathBuf);
-      if (EFI_ERROR(Status)) {
-        AsciiSPrint(Buf, sizeof(Buf), "can't open replacement partition: %r", Status);
-        FastbootFail(Buf);
-        return;
-      }
-
-      // flash
-      FastbootInfo("INFO: redirect flash to ESP");
-      HandleFileFlash (PartitionFile, Data, (UINTN)Size);
+      if (EFI_ERROR(Status))
+        return Status;
 
-      // close
-      FileHandleClose(PartitionFile);
-      return;
+      if (OpenMode & EFI_FILE_MODE_WRITE)
+        FastbootInfo("INFO: redirect flash to ESP");
+      return EFI_SUCCESS;
     }
   }
 
 DO_BLOCKIO_FLASH:
-  Context.PartitionName = Ascii2Unicode(Arg);
-  Context.Data          = Data;
-  Context.DataSize      = (UINTN)Size;
-  Context.Done          = FALSE;
+  Context.PartitionName = Ascii2Unicode(Name);
+  Context.BlockIo       = NULL;
+  if (Context.PartitionName == NULL) {
+    FastbootFail("can't allocate memory");
+    return EFI_OUT_OF_RESOURCES;
+  }
 
-  // flash
   VisitAllInstancesOfProtocol (
     &gEfiBlockIoProtocolGuid,
-    HandleBlockIoFlash,
+    FindBlockIoByPartitionName,
     &Context
     );
 
-  if(Context.PartitionName)
-    FreePool(Context.PartitionName);
+  FreePool(Context.PartitionName);
 
-  if(!Context.Done)
+  if(!Context.BlockIo) {
     FastbootFail("partition not found");
+    return EFI_NOT_FOUND;
+  }
+
+  if (OpenMode & EFI_FILE_MODE_WRITE) {
+    Target->Buffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE), EFI_PAGE_SIZE);
+    if (Target->Buffer == NULL) {
+      FastbootFail("can't allocate memory");
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  Target->BlockIo = Context.BlockIo;
+  Target->Handle = Context.Handle;
+  Target->Size = MultU64x32(Context.BlockIo->Media->LastBlock + 1, Context.BlockIo->Media->BlockSize);
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+FlashTargetWriteBuffer (
+  IN FLASH_TARGET *Target
+)
+{
+  EFI_BLOCK_IO_PROTOCOL *BlockIo = Target->BlockIo;
+  UINTN                 WriteSize;
+  EFI_STATUS            Status;
+
+  if (Target->BufferUsed == 0)
+    return EFI_SUCCESS;
+
+  // pad the last block with zeros
+  WriteSize = ROUNDUP(Target->BufferUsed, BlockIo->Media->BlockSize);
+  ZeroMem(Target->Buffer + Target->BufferUsed, WriteSize - Target->BufferUsed);
+
+  Status = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId, DivU64x32(Target->Offset, BlockIo->Media->BlockSize), WriteSize, Target->Buffer);
+  if (EFI_ERROR(Status)) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "can't write blocks %r", Status);
+    return Status;
+  }
+
+  Target->Offset += WriteSize;
+  Target->BufferUsed = 0;
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+HandleBlockIoFlash (
+  IN FLASH_TARGET *Target,
+  IN UINT8        *Data,
+  IN UINTN        Size
+  )
+{
+  EFI_BLOCK_IO_PROTOCOL *BlockIo = Target->BlockIo;
+  UINT32                BlockSize = BlockIo->Media->BlockSize;
+  UINT32                IoAlign = MAX(BlockIo->Media->IoAlign, 1);
+  UINTN                 WriteSize;
+  EFI_STATUS            Status;
+
+  while (Size > 0) {
+    // write whole blocks directly if there's no pending data
+    if (Target->BufferUsed == 0 && Size >= BlockSize && ((UINTN)Data % IoAlign) == 0) {
+      WriteSize = ROUNDDOWN(Size, BlockSize);
+
+      Status = BlockIo->WriteBlocks(BlockIo, BlockIo->Media->MediaId, DivU64x32(Target->Offset, BlockSize), WriteSize, Data);
+      if (EFI_ERROR(Status)) {
+        AsciiSPrint(Target->Error, sizeof(Target->Error), "can't write blocks %r", Status);
+        return Status;
+      }
+
+      Target->Offset += WriteSize;
+      Data += WriteSize;
+      Size -= WriteSize;
+      continue;
+    }
+
+    // collect everything else in the bounce buffer
+    WriteSize = MIN(Size, FLASH_BUFFER_SIZE - Target->BufferUsed);
+    CopyMem(Target->Buffer + Target->BufferUsed, Data, WriteSize);
+    Target->BufferUsed += WriteSize;
+    Data += WriteSize;
+    Size -= WriteSize;
+
+    if (Target->BufferUsed == FLASH_BUFFER_SIZE) {
+      Status = FlashTargetWriteBuffer(Target);
+      if (EFI_ERROR(Status))
+        return Status;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+HandleFileFlash (
+  IN FLASH_TARGET *Target,
+  IN UINT8        *Data,
+  IN UINTN        Size
+)
+{
+  EFI_STATUS Status;
+
+  // write data
+  UINTN WriteSize = Size;
+  Status = FileHandleWrite(Target->File, &WriteSize, Data);
+  if (EFI_ERROR (Status)) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "can't write: %r", Status);
+    return Status;
+  }
+
+  // validate return value
+  if (WriteSize!=Size) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "short write: %u/%u bytes written", WriteSize, Size);
+    return EFI_DEVICE_ERROR;
+  }
+
+  Target->Offset += WriteSize;
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+FlashTargetWrite (
+  IN FLASH_TARGET *Target,
+  IN VOID         *Data,
+  IN UINTN        Size
+)
+{
+  // validate size
+  if (Target->Offset + Target->BufferUsed + Size > Target->Size) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "data size exceeds partition size");
+    return EFI_VOLUME_FULL;
+  }
+
+  if (Target->BlockIo)
+    return HandleBlockIoFlash(Target, Data, Size);
+  else
+    return HandleFileFlash(Target, Data, Size);
+}
+
+STATIC
+EFI_STATUS
+FlashTargetSkip (
+  IN VOID   *Context,
+  IN UINT64 Size
+)
+{
+  FLASH_TARGET *Target = Context;
+  EFI_STATUS   Status;
+
+  // validate size
+  if (Target->Offset + Target->BufferUsed + Size > Target->Size) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "data size exceeds partition size");
+    return EFI_VOLUME_FULL;
+  }
+
+  if (Target->BlockIo) {
+    // we can only skip whole blocks
+    if (Target->BufferUsed % Target->BlockIo->Media->BlockSize || Size % Target->BlockIo->Media->BlockSize) {
+      AsciiSPrint(Target->Error, sizeof(Target->Error), "sparse block size doesn't match the partition");
+      return EFI_INVALID_PARAMETER;
+    }
+
+    Status = FlashTargetWriteBuffer(Target);
+    if (EFI_ERROR(Status))
+      return Status;
+
+    Target->Offset += Size;
+    return EFI_SUCCESS;
+  }
+
+  Status = FileHandleSetPosition(Target->File, Target->Offset + Size);
+  if (EFI_ERROR(Status)) {
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "can't seek: %r", Status);
+    return Status;
+  }
+
+  Target->Offset += Size;
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+FlashTargetSparseWrite (
+  IN VOID  *Context,
+  IN VOID  *Data,
+  IN UINTN Size
+)
+{
+  return FlashTargetWrite(Context, Data, Size);
+}
+
+STATIC
+EFI_STATUS
+FlashTargetFill (
+  IN VOID   *Context,
+  IN UINT32 Pattern,
+  IN UINT64 Size
+)
+{
+  FLASH_TARGET *Target = Context;
+  UINT32       *Ptr;
+  UINTN        Index;
+  UINTN        WriteSize;
+  EFI_STATUS   Status;
+
+  // all chunks get written from the same pattern buffer
+  if (Target->FillBuffer == NULL || Target->FillPattern != Pattern) {
+    if (Target->FillBuffer == NULL) {
+      Target->FillBuffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE), EFI_PAGE_SIZE);
+      if (Target->FillBuffer == NULL) {
+        AsciiSPrint(Target->Error, sizeof(Target->Error), "can't allocate memory");
+        return EFI_OUT_OF_RESOURCES;
+      }
+    }
+
+    Ptr = (UINT32*)Target->FillBuffer;
+    for (Index=0; Index<FLASH_BUFFER_SIZE/sizeof(UINT32); Index++)
+      Ptr[Index] = Pattern;
+    Target->FillPattern = Pattern;
+  }
+
+  // write whole blocks directly instead of through the bounce buffer
+  if (Target->BlockIo && (Target->BufferUsed % Target->BlockIo->Media->BlockSize) == 0) {
+    Status = FlashTargetWriteBuffer(Target);
+    if (EFI_ERROR(Status))
+      return Status;
+  }
+
+  while (Size > 0) {
+    WriteSize = (UINTN)MIN(Size, (UINT64)FLASH_BUFFER_SIZE);
+
+    Status = FlashTargetWrite(Target, Target->FillBuffer, WriteSize);
+    if (EFI_ERROR(Status))
+      return Status;
+
+    Size -= WriteSize;
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+FlashTargetFeed (
+  IN FLASH_TARGET *Target,
+  IN VOID         *Data,
+  IN UINTN        Size
+)
+{
+  EFI_STATUS Status;
+
+  if (!Target->Started) {
+    Target->Started = TRUE;
+    Target->IsSparse = SparseIsImage(Data, Size);
+
+    if (Target->IsSparse) {
+      FastbootInfo("INFO: sparse image");
+      SparseInit(&Target->Sparse, FlashTargetSparseWrite, FlashTargetFill, FlashTargetSkip, Target);
+    }
+  }
+
+  if (!Target->IsSparse)
+    return FlashTargetWrite(Target, Data, Size);
+
+  Status = SparseFeed(&Target->Sparse, Data, Size);
+  if (EFI_ERROR(Status) && Target->Error[0] == 0)
+    AsciiSPrint(Target->Error, sizeof(Target->Error), "invalid sparse image: %r", Status);
+
+  return Status;
+}
+
+STATIC
+EFI_STATUS
+FlashTargetClose (
+  IN FLASH_TARGET *Target,
+  IN EFI_STATUS   Status
+)
+{
+  if (!EFI_ERROR(Status) && Target->IsSparse) {
+    Status = SparseFinish(&Target->Sparse);
+    if (EFI_ERROR(Status))
+      AsciiSPrint(Target->Error, sizeof(Target->Error), "sparse image is truncated");
+  }
+
+  // write the partial last block
+  if (!EFI_ERROR(Status) && Target->BlockIo) {
+    Status = FlashTargetWriteBuffer(Target);
+    if (!EFI_ERROR(Status))
+      Target->BlockIo->FlushBlocks(Target->BlockIo);
+  }
+
+  if (Target->Buffer) {
+    FreeAlignedPages(Target->Buffer, EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE));
+    Target->Buffer = NULL;
+  }
+
+  if (Target->FillBuffer) {
+    FreeAlignedPages(Target->FillBuffer, EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE));
+    Target->FillBuffer = NULL;
+  }
+
+  if (Target->File) {
+    FileHandleClose(Target->File);
+    Target->File = NULL;
+  }
+
+  Target->BlockIo = NULL;
+  Target->Handle = NULL;
+
+  return Status;
 }
 
 STATIC
 VOID
-CommandErase (
+FlashTargetRespond (
+  IN FLASH_TARGET *Target,
+  IN EFI_STATUS   Status
+)
+{
+  CHAR8 Buf[100];
+
+  if (!EFI_ERROR(Status)) {
+    FastbootOkay("");
+  }
+  else if (Target->Error[0]) {
+    FastbootFail(Target->Error);
+  }
+  else {
+    AsciiSPrint(Buf, sizeof(Buf), "can't flash: %r", Status);
+    FastbootFail(Buf);
+  }
+}
+
+STATIC
+VOID
+CommandFlash (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  FLASH_TARGET       Target;
+  EFI_STATUS         Status;
+  UINTN              Offset;
+
+  Status = FlashTargetOpen(&Target, Arg, EFI_FILE_MODE_READ|EFI_FILE_MODE_WRITE);
+  if (EFI_ERROR(Status))
+    return;
+
+  // write in bounded chunks
+  for (Offset=0; Offset<Size; Offset+=FASTBOOT_DOWNLOAD_CHUNK_SIZE) {
+    Status = FlashTargetFeed(&Target, (UINT8*)Data + Offset, MIN(Size - Offset, FASTBOOT_DOWNLOAD_CHUNK_SIZE));
+    if (EFI_ERROR(Status))
+      break;
+
+    FastbootProgress("Flashing", Offset, Size);
+  }
+
+  Status = FlashTargetClose(&Target, Status);
+  FlashTargetRespond(&Target, Status);
+}
+
+STATIC FLASH_TARGET mStreamTarget;
+STATIC BOOLEAN      mStreamTargetOpen = FALSE;
+
+STATIC
+EFI_STATUS
+StreamConsumer (
+  IN VOID   *Context,
+  IN VOID   *Data,
+  IN UINTN  Size,
+  IN UINT64 Offset
+)
+{
+  return FlashTargetFeed(Context, Data, Size);
+}
+
+STATIC
+VOID
+StreamFinish (
+  IN VOID       *Context,
+  IN EFI_STATUS Status
+)
+{
+  Status = FlashTargetClose(Context, Status);
+  mStreamTargetOpen = FALSE;
+
+  FlashTargetRespond(Context, Status);
+}
+
+STATIC FASTBOOT_DOWNLOAD_HANDLER mStreamHandler = {
+  StreamConsumer,
+  StreamFinish,
+  &mStreamTarget,
+};
+
+STATIC
+VOID
+CommandStream (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  EFI_STATUS Status;
+
+  // replace the previous target
+  if (mStreamTargetOpen) {
+    FastbootSetDownloadHandler(NULL);
+    FlashTargetClose(&mStreamTarget, EFI_ABORTED);
+    mStreamTargetOpen = FALSE;
+  }
+
+  Status = FlashTargetOpen(&mStreamTarget, Arg, EFI_FILE_MODE_READ|EFI_FILE_MODE_WRITE);
+  if (EFI_ERROR(Status))
+    return;
+
+  mStreamTargetOpen = TRUE;
+  FastbootSetDownloadHandler(&mStreamHandler);
+
+  FastbootInfo("the next download will be written to the partition directly");
+  FastbootOkay("");
+}
+
+STATIC
+EFI_STATUS
+FetchRead (
+  IN  FLASH_TARGET *Target,
+  IN  UINT64       Offset,
+  IN  UINT8        *Buffer,
+  IN  UINTN        BufferSize,
+  IN  UINT64       Left,
+  OUT UINT8        **Data,
+  OUT UINTN        *Size
+)
+{
+  EFI_BLOCK_IO_PROTOCOL *BlockIo = Target->BlockIo;
+  UINTN                 Skip;
+  UINTN                 ReadSize;
+  EFI_STATUS            Status;
+
+  if (BlockIo) {
+    // read whole blocks and send the requested part only
+    Skip = (UINTN)ModU64x32(Offset, BlockIo->Media->BlockSize);
+    ReadSize = (UINTN)MIN((UINT64)BufferSize, ROUNDUP(Skip + Left, BlockIo->Media->BlockSize));
+
+    Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, DivU64x32(Offset, BlockIo->Media->BlockSize), ReadSize, Buffer);
+    if (EFI_ERROR(Status))
+      return Status;
+
+    *Data = Buffer + Skip;
+    *Size = (UINTN)MIN((UINT64)(ReadSize - Skip), Left);
+    return EFI_SUCCESS;
+  }
+
+  ReadSize = (UINTN)MIN((UINT64)BufferSize, Left);
+  Status = FileHandleRead(Target->File, &ReadSize, Buffer);
+  if (EFI_ERROR(Status))
+    return Status;
+  if (ReadSize == 0)
+    return EFI_END_OF_FILE;
+
+  *Data = Buffer;
+  *Size = ReadSize;
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+CommandFetch (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  FLASH_TARGET Target;
+  EFI_STATUS   Status;
+  EFI_STATUS   ReadStatus;
+  CHAR8        Buf[100];
+  CHAR8        *OffsetStr;
+  CHAR8        *SizeStr;
+  CHAR8        *Ptr;
+  UINT64       Offset;
+  UINT64       Length;
+  UINT64       Left;
+  UINT8        *Buffer;
+  UINT8        *ReadData;
+  UINTN        ReadSize;
+
+  // split partition:offset:size
+  OffsetStr = NULL;
+  SizeStr = NULL;
+  for (Ptr=Arg; *Ptr; Ptr++) {
+    if (Ptr[0]==':') {
+      Ptr[0] = '\0';
+      if (OffsetStr == NULL)
+        OffsetStr = &Ptr[1];
+      else {
+        SizeStr = &Ptr[1];
+        break;
+      }
+    }
+  }
+
+  Status = FlashTargetOpen(&Target, Arg, EFI_FILE_MODE_READ);
+  if (EFI_ERROR(Status))
+    return;
+
+  // validate range
+  Offset = OffsetStr ? AsciiStrHexToUint64(OffsetStr) : 0;
+  if (Offset > Target.Size) {
+    FastbootFail("offset exceeds partition size");
+    goto Done;
+  }
+
+  Length = SizeStr ? AsciiStrHexToUint64(SizeStr) : Target.Size - Offset;
+  if (Length > Target.Size - Offset) {
+    FastbootFail("size exceeds partition size");
+    goto Done;
+  }
+  if (Length > FASTBOOT_MAX_FETCH_SIZE) {
+    FastbootFail("size exceeds max-fetch-size");
+    goto Done;
+  }
+
+  Buffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE), EFI_PAGE_SIZE);
+  if (Buffer == NULL) {
+    FastbootFail("can't allocate memory");
+    goto Done;
+  }
+
+  if (Target.File) {
+    Status = FileHandleSetPosition(Target.File, Offset);
+    if (EFI_ERROR(Status)) {
+      AsciiSPrint(Buf, sizeof(Buf), "can't seek: %r", Status);
+      FastbootFail(Buf);
+      goto FreeBuffer;
+    }
+  }
+
+  Status = FastbootUploadStart((UINT32)Length);
+  if (EFI_ERROR(Status))
+    goto FreeBuffer;
+
+  // the host expects exactly Length bytes, so we send zeros after
+  // read errors and report the error afterwards
+  ReadStatus = EFI_SUCCESS;
+  for (Left = Length; Left > 0; Left -= ReadSize, Offset += ReadSize) {
+    if (!EFI_ERROR(ReadStatus))
+      ReadStatus = FetchRead(&Target, Offset, Buffer, FLASH_BUFFER_SIZE, Left, &ReadData, &ReadSize);
+
+    if (EFI_ERROR(ReadStatus)) {
+      ReadData = Buffer;
+      ReadSize = (UINTN)MIN((UINT64)FLASH_BUFFER_SIZE, Left);
+      ZeroMem(ReadData, ReadSize);
+    }
+
+    Status = FastbootUploadData(ReadData, ReadSize);
+    if (EFI_ERROR(Status))
+      goto FreeBuffer;
+
+    FastbootProgress("Uploading", Length - Left, Length);
+  }
+
+  if (EFI_ERROR(ReadStatus)) {
+    AsciiSPrint(Buf, sizeof(Buf), "can't read: %r", ReadStatus);
+    FastbootFail(Buf);
+  }
+  else {
+    FastbootOkay("");
+  }
+
+FreeBuffer:
+  FreeAlignedPages(Buffer, EFI_SIZE_TO_PAGES(FLASH_BUFFER_SIZE));
+Done:
+  FlashTargetClose(&Target, EFI_ABORTED);
+}
+
+// hashing doesn't go over USB, so we can use bigger reads
+#define HASH_BUFFER_SIZE SIZE_4MB
+
+STATIC
+VOID
+CommandHash (
   CHAR8 *Arg,
   VOID *Data,
   UINT32 Size
 )
 {
-  FastbootInfo("WARNING: erase is not supported");
+  FLASH_TARGET        Target;
+  EFI_STATUS          Status;
+  CHAR8               Buf[FASTBOOT_COMMAND_MAX_LENGTH];
+  CHAR8               *Args[5];
+  UINTN               NumArgs;
+  CHAR8               *Ptr;
+  BOOLEAN             UseSha256;
+  UINT64              Offset;
+  UINT64              Length;
+  UINT64              Left;
+  UINT64              StartTime;
+  UINT64              Elapsed;
+  UINT8               *Buffer;
+  UINT8               *ReadData;
+  UINTN               ReadSize;
+  UINTN               Index;
+  UINT32              Crc;
+  UTIL_SHA256_CONTEXT Sha256;
+  UINT8               Digest[SHA256_DIGEST_SIZE];
+  CHAR8               Hex[SHA256_DIGEST_SIZE*2 + 1];
+
+  // split arguments: <partition> [offset size] [crc32|sha256]
+  // one more than allowed is collected so extra arguments get rejected
+  NumArgs = 0;
+  for (Ptr=Arg; *Ptr && NumArgs<5; ) {
+    while (*Ptr==' ')
+      *Ptr++ = '\0';
+    if (*Ptr == '\0')
+      break;
+
+    Args[NumArgs++] = Ptr;
+    while (*Ptr && *Ptr!=' ')
+      Ptr++;
+  }
+  if (NumArgs == 0 || NumArgs > 4) {
+    FastbootFail("usage: oem hash <partition> [offset size] [crc32|sha256]");
+    return;
+  }
+
+  UseSha256 = FALSE;
+  if (NumArgs == 2 || NumArgs == 4) {
+    if (!AsciiStrCmp(Args[NumArgs-1], "sha256"))
+      UseSha256 = TRUE;
+    else if (AsciiStrCmp(Args[NumArgs-1], "crc32")) {
+      FastbootFail("unsupported algorithm");
+      return;
+    }
+    NumArgs--;
+  }
+
+  Status = FlashTargetOpen(&Target, Args[0], EFI_FILE_MODE_READ);
+  if (EFI_ERROR(Status))
+    return;
+
+  // validate range
+  Offset = 0;
+  Length = Target.Size;
+  if (NumArgs == 3) {
+    Offset = AsciiStrHexToUint64(Args[1]);
+    Length = AsciiStrHexToUint64(Args[2]);
+  }
+  if (Offset > Target.Size || Length > Target.Size - Offset) {
+    FastbootFail("range exceeds partition size");
+    goto Done;
+  }
+
+  Buffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(HASH_BUFFER_SIZE), EFI_PAGE_SIZE);
+  if (Buffer == NULL) {
+    FastbootFail("can't allocate memory");
+    goto Done;
+  }
+
+  if (Target.File) {
+    Status = FileHandleSetPosition(Target.File, Offset);
+    if (EFI_ERROR(Status)) {
+      AsciiSPrint(Buf, sizeof(Buf), "can't seek: %r", Status);
+      FastbootFail(Buf);
+      goto FreeBuffer;
+    }
+  }
+
+  StartTime = UtilGetTimeUs();
+  Crc = 0;
+  UtilSha256Init(&Sha256);
+
+  for (Left = Length; Left > 0; Left -= ReadSize, Offset += ReadSize) {
+    Status = FetchRead(&Target, Offset, Buffer, HASH_BUFFER_SIZE, Left, &ReadData, &ReadSize);
+    if (EFI_ERROR(Status)) {
+      AsciiSPrint(Buf, sizeof(Buf), "can't read: %r", Status);
+      FastbootFail(Buf);
+      goto FreeBuffer;
+    }
+
+    if (UseSha256)
+      UtilSha256Update(&Sha256, ReadData, ReadSize);
+    else
+      Crc = UtilCrc32(ReadData, ReadSize, Crc);
+
+    FastbootProgress("Hashing", Length - Left, Length);
+  }
+
+  Elapsed = UtilGetTimeUs() - StartTime;
+  AsciiSPrint(Buf, sizeof(Buf), "hashed %lu MB in %lu ms",
+    DivU64x32(Length, SIZE_1MB), DivU64x32(Elapsed, 1000));
+  FastbootInfo(Buf);
+
+  if (UseSha256) {
+    UtilSha256Final(&Sha256, Digest);
+
+    // the hex digest doesn't fit into a single response
+    for (Index=0; Index<SHA256_DIGEST_SIZE; Index++)
+      AsciiSPrint(Hex + Index*2, 3, "%02x", Digest[Index]);
+    FastbootInfo("sha256:");
+    FastbootSendString(Hex, SHA256_DIGEST_SIZE);
+    FastbootSendString(Hex + SHA256_DIGEST_SIZE, SHA256_DIGEST_SIZE);
+  }
+  else {
+    AsciiSPrint(Buf, sizeof(Buf), "crc32: %08x", Crc);
+    FastbootInfo(Buf);
+  }
+
   FastbootOkay("");
+
+FreeBuffer:
+  FreeAlignedPages(Buffer, EFI_SIZE_TO_PAGES(HASH_BUFFER_SIZE));
+Done:
+  FlashTargetClose(&Target, EFI_ABORTED);
+}
+
+// zero buffer for erasing, allocated once and reused
+#define ERASE_BUFFER_SIZE SIZE_4MB
+STATIC VOID *mEraseBuffer = NULL;
+
+STATIC
+EFI_STATUS
+EraseWithProtocol (
+  IN FLASH_TARGET *Target
+)
+{
+  EFI_ERASE_BLOCK_PROTOCOL *EraseBlock;
+  EFI_ERASE_BLOCK_TOKEN    Token;
+  UINT64                   Offset;
+  UINTN                    EraseSize;
+  EFI_STATUS               Status;
+
+  Status = gBS->HandleProtocol (
+                  Target->Handle,
+                  &gEfiEraseBlockProtocolGuid,
+                  (VOID **)&EraseBlock
+                  );
+  if (EFI_ERROR (Status)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  // UINTN sizes can't cover big partitions on 32bit, so erase in 1GB steps
+  for (Offset = 0; Offset < Target->Size; Offset += EraseSize) {
+    EraseSize = (UINTN)MIN(Target->Size - Offset, (UINT64)SIZE_1GB);
+
+    // a NULL event makes this a blocking call
+    ZeroMem(&Token, sizeof(Token));
+    Status = EraseBlock->EraseBlocks(EraseBlock, Target->BlockIo->Media->MediaId, DivU64x32(Offset, Target->BlockIo->Media->BlockSize), &Token, EraseSize);
+    if (EFI_ERROR(Status)) {
+      // let the caller fall back to zero writes if nothing was erased yet
+      if (Status == EFI_UNSUPPORTED && Offset == 0)
+        return Status;
+
+      AsciiSPrint(Target->Error, sizeof(Target->Error), "can't erase blocks %r", Status);
+      return EFI_DEVICE_ERROR;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+EraseWithZeros (
+  IN FLASH_TARGET *Target
+)
+{
+  CHAR8      Buf[FASTBOOT_COMMAND_MAX_LENGTH];
+  UINT64     Left;
+  UINTN      WriteSize;
+  UINTN      Percent;
+  UINTN      LastPercent;
+  EFI_STATUS Status;
+
+  if (mEraseBuffer == NULL) {
+    mEraseBuffer = AllocateAlignedPages(EFI_SIZE_TO_PAGES(ERASE_BUFFER_SIZE), EFI_PAGE_SIZE);
+    if (mEraseBuffer == NULL) {
+      AsciiSPrint(Target->Error, sizeof(Target->Error), "can't allocate memory");
+      return EFI_OUT_OF_RESOURCES;
+    }
+    ZeroMem(mEraseBuffer, ERASE_BUFFER_SIZE);
+  }
+
+  LastPercent = 0;
+  for (Left = Target->Size; Left > 0; Left -= WriteSize) {
+    WriteSize = (UINTN)MIN(Left, (UINT64)ERASE_BUFFER_SIZE);
+
+    Status = FlashTargetWrite(Target, mEraseBuffer, WriteSize);
+    if (EFI_ERROR(Status))
+      return Status;
+
+    FastbootProgress("Erasing", Target->Size - Left, Target->Size);
+
+    // report progress in 25% steps
+    Percent = (UINTN)DivU64x64Remainder(MultU64x32(Target->Size - Left + WriteSize, 100), Target->Size, NULL);
+    if (Percent / 25 > LastPercent / 25 && Percent < 100) {
+      AsciiSPrint(Buf, sizeof(Buf), "erasing: %u%%", Percent);
+      FastbootInfo(Buf);
+    }
+    LastPercent = Percent;
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+VOID
+CommandErase (
+  CHAR8 *Arg,
+  VOID *Data,
+  UINT32 Size
+)
+{
+  FLASH_TARGET Target;
+  EFI_STATUS   Status;
+  UINT64       StartTime;
+  CHAR8        Buf[FASTBOOT_COMMAND_MAX_LENGTH];
+
+  StartTime = UtilGetTimeUs();
+
+  Status = FlashTargetOpen(&Target, Arg, EFI_FILE_MODE_READ|EFI_FILE_MODE_WRITE);
+  if (EFI_ERROR(Status))
+    return;
+
+  // let the storage discard the blocks if possible
+  Status = EFI_UNSUPPORTED;
+  if (Target.BlockIo)
+    Status = EraseWithProtocol(&Target);
+
+  // replacement files keep their size, so they get zero filled as well
+  if (Status == EFI_UNSUPPORTED)
+    Status = EraseWithZeros(&Target);
+
+  Status = FlashTargetClose(&Target, Status);
+  if (!EFI_ERROR(Status)) {
+    AsciiSPrint(Buf, sizeof(Buf), "erased %lu MB in %lu ms",
+      DivU64x32(Target.Size, SIZE_1MB), DivU64x32(UtilGetTimeUs() - StartTime, 1000));
+    FastbootInfo(Buf);
+  }
+
+  FlashTargetRespond(&Target, Status);
 }
 
 VOID
@@ -749,7 +1587,11 @@ FastbootCommandsAdd (
 )
 {
   FastbootRegister("flash:", CommandFlash);
+  FastbootRegister("oem stream", CommandStream);
   FastbootRegister("erase:", CommandErase);
+  FastbootRegister("fetch:", CommandFetch);
+  FastbootRegister("oem hash", CommandHash);
+  FastbootPublish("max-fetch-size", FASTBOOT_MAX_FETCH_SIZE_STR);
 
   FastbootRegister("reboot", CommandReboot);
   FastbootRegister("reboot-bootloader", CommandRebootBootloader);
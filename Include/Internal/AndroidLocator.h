@@ -9,7 +9,10 @@ typedef struct {
   multiboot_handle_t    *mbhandle;
   BOOLEAN               DisablePatching;
   BOOLEAN               IsRecovery;
+  LOADER_RAMDISK_TYPE   RamdiskType;
   LAST_BOOT_ENTRY       LastBootEntry;
+  // the context still has to be identified from the mbhandle's boot partition
+  BOOLEAN               IdentifyPending;
 } MENU_ENTRY_PDATA;
 
 #define RECOVERY_MENU_SIGNATURE             SIGNATURE_32 ('r', 'e', 'c', 'm')
@@ -31,6 +34,47 @@ typedef struct {
   BOOLEAN IsDual;
 } IMGINFO_CACHE;
 
+// cache variables are this header followed by Count entries
+typedef struct {
+  UINT32 Version;
+  UINT32 Count;
+} CACHE_VARIABLE_HEADER;
+
+#define RDINFO_CACHE_VERSION 1
+
+typedef struct {
+  // boot image checksum
+  UINT32        Checksum;
+  // -1 for the image, 0 and 1 for the halves of a dual ramdisk
+  INT32         Id;
+  IMGINFO_CACHE Info;
+} RDINFO_CACHE_ENTRY;
+
+#define PROBE_CACHE_VERSION 1
+
+// a partition which doesn't contain a bootable image
+typedef struct {
+  // unique partition GUID, or the MBR signature and partition number
+  EFI_GUID      PartitionGuid;
+  UINT64        Size;
+  // crc32 of the first bytes of the partition
+  UINT32        HeaderCrc;
+} PROBE_CACHE_ENTRY;
+
+#define MULTIBOOT_INDEX_VERSION 1
+
+// a multiboot ROM whose multiboot.ini doesn't have to be parsed during the scan
+typedef struct {
+  // crc32 of the ROM's LAST_BOOT_ENTRY
+  UINT32        PathCrc;
+  UINT64        IniSize;
+  EFI_TIME      IniTime;
+  EFI_TIME      DirTime;
+  CHAR8         Name[64];
+  CHAR8         Description[128];
+  BOOLEAN       HasIcon;
+} MULTIBOOT_INDEX_ENTRY;
+
 EFI_STATUS
 AndroidLocatorInit (
   VOID
@@ -72,4 +116,14 @@ AndroidLocatorGetMenuIdFromLastBootEntry (
   LAST_BOOT_ENTRY *LastBootEntry
 );
 
+EFI_STATUS
+AndroidLocatorBootLastBootEntry (
+  LAST_BOOT_ENTRY *LastBootEntry
+);
+
+EFI_STATUS
+AndroidLocatorLoadMultibootHandle (
+  multiboot_handle_t *mbhandle
+);
+
 #endif /* __INTERNAL_ANDROIDLOCATOR_H__ */
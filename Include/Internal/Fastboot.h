@@ -3,6 +3,56 @@
 
 #define FASTBOOT_COMMAND_MAX_LENGTH 64
 
+// size of a single USB receive in the chunked download engine
+#define FASTBOOT_DOWNLOAD_CHUNK_SIZE SIZE_1MB
+
+// largest download we're willing to buffer in RAM
+#define FASTBOOT_MAX_DOWNLOAD_SIZE SIZE_256MB
+#define FASTBOOT_MAX_DOWNLOAD_SIZE_STR "0x10000000"
+
+// fetches are streamed, this is just a limit of the protocol
+#define FASTBOOT_MAX_FETCH_SIZE SIZE_2GB
+#define FASTBOOT_MAX_FETCH_SIZE_STR "0x80000000"
+
+//
+// Called for every received chunk.
+// Data stays valid until the second next chunk has been received,
+// so consumers may keep a reference to the previous chunk.
+//
+typedef
+EFI_STATUS
+(*FASTBOOT_DATA_CONSUMER)(
+  IN VOID   *Context,
+  IN VOID   *Data,
+  IN UINTN  Size,
+  IN UINT64 Offset
+);
+
+typedef struct {
+  UINT32  Length;
+  UINT32  Received;
+  UINTN   ChunkIndex;
+
+  // receive directly into this buffer if set, use the ping-pong buffers otherwise
+  UINT8   *Destination;
+  UINT8   *Buffers[2];
+
+  // statistics
+  UINT64  StartTime;
+  UINT64  SlowestChunkTime;
+  UINTN   SlowestChunkIndex;
+} FASTBOOT_DOWNLOAD;
+
+//
+// Takes over the data phase of the next download command.
+// Finish gets called with the status of the transfer and has to send the response.
+//
+typedef struct {
+  FASTBOOT_DATA_CONSUMER Consumer;
+  VOID                   (*Finish)(IN VOID *Context, IN EFI_STATUS Status);
+  VOID                   *Context;
+} FASTBOOT_DOWNLOAD_HANDLER;
+
 VOID
 FastbootInit (
   VOID
@@ -62,4 +112,60 @@ FastbootSendBuf (
   IN UINTN Size
 );
 
+EFI_STATUS
+FastbootDownloadStart (
+  OUT FASTBOOT_DOWNLOAD *Download,
+  IN  UINT32            Length,
+  IN  VOID              *Destination OPTIONAL
+);
+
+EFI_STATUS
+FastbootDownloadNext (
+  IN  FASTBOOT_DOWNLOAD *Download,
+  OUT VOID              **Data,
+  OUT UINTN             *Size
+);
+
+VOID
+FastbootDownloadFinish (
+  IN FASTBOOT_DOWNLOAD *Download
+);
+
+EFI_STATUS
+FastbootDownloadStream (
+  IN UINT32                 Length,
+  IN VOID                   *Destination OPTIONAL,
+  IN FASTBOOT_DATA_CONSUMER Consumer OPTIONAL,
+  IN VOID                   *Context
+);
+
+EFI_STATUS
+FastbootUploadStart (
+  IN UINT32 Length
+);
+
+EFI_STATUS
+FastbootUploadData (
+  IN VOID  *Data,
+  IN UINTN Size
+);
+
+EFI_STATUS
+FastbootStage (
+  IN CONST VOID *Data,
+  IN UINTN      Size
+);
+
+VOID
+FastbootProgress (
+  IN CONST CHAR8 *Text,
+  IN UINT64      Done,
+  IN UINT64      Total
+);
+
+VOID
+FastbootSetDownloadHandler (
+  IN FASTBOOT_DOWNLOAD_HANDLER *Handler OPTIONAL
+);
+
 #endif /* __INTERNAL_FASTBOOT_H__ */
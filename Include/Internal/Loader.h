@@ -16,8 +16,62 @@ typedef struct {
   // file: boot image file path
   // multiboot: multiboot.ini file path
   CHAR8 FilePathName[1024];
+
+  // how the entry got booted, LoaderBootContext fills these in
+  UINT32 Flags;
 } LAST_BOOT_ENTRY;
 
+// the flags below were recorded, older variables don't have them
+#define LAST_BOOT_FLAG_VALID              BIT0
+#define LAST_BOOT_FLAG_DISABLE_PATCHING   BIT1
+// also selects the recovery half of dual ramdisks
+#define LAST_BOOT_FLAG_RECOVERY           BIT2
+// the entry doesn't describe what got booted, e.g. a multiboot ROM
+// booted with a recovery from the recovery menu
+#define LAST_BOOT_FLAG_INDIRECT           BIT3
+
+typedef struct {
+  UINT64 Hits;
+  UINT64 Misses;
+  UINT64 ReadAheads;
+  UINT64 RawReads;
+  UINT64 RawBytes;
+  UINT64 ReadErrors;
+} LOADER_IO_STATS;
+
+// phases of a boot, in the order they happen
+typedef enum {
+  LOADER_BOOT_PHASE_IDENTIFY = 0,
+  LOADER_BOOT_PHASE_LOAD,
+  LOADER_BOOT_PHASE_KERNEL,
+  LOADER_BOOT_PHASE_RAMDISK,
+  LOADER_BOOT_PHASE_CMDLINE,
+  LOADER_BOOT_PHASE_PREPARE,
+  LOADER_BOOT_PHASE_VARIABLES,
+  LOADER_BOOT_PHASE_EXIT_BOOT_SERVICES,
+  LOADER_BOOT_PHASE_MAX,
+} LOADER_BOOT_PHASE;
+
+#define LOADER_BOOT_PROFILE_VERSION 1
+
+// stored in the 'LastBootProfile' variable right before ExitBootServices
+typedef struct {
+  UINT32 Version;
+  // bitmask of the phases which were reached
+  UINT32 Reached;
+  // start of each phase in us, relative to the start of the boot
+  UINT32 Start[LOADER_BOOT_PHASE_MAX];
+} LOADER_BOOT_PROFILE;
+
+typedef enum {
+  // contents unknown, decompress and inspect it
+  LOADER_RAMDISK_UNKNOWN = 0,
+  // a single ramdisk, it can be booted without decompressing it
+  LOADER_RAMDISK_SINGLE,
+  // contains sbin/ramdisk.cpio and sbin/ramdisk-recovery.cpio
+  LOADER_RAMDISK_DUAL,
+} LOADER_RAMDISK_TYPE;
+
 typedef struct {
   // ini values
   CHAR8  *Name;
@@ -31,6 +85,9 @@ typedef struct {
 
   // set by MultibootCallback
   CHAR8* MultibootConfig;
+
+  // FALSE if only the name and description were taken from the ROM index
+  BOOLEAN IniParsed;
 } multiboot_handle_t;
 
 #define PARTITION_LIST_SIGNATURE             SIGNATURE_32 ('m', 'b', 'p', 't')
@@ -77,6 +134,7 @@ LoaderBootContext (
   IN multiboot_handle_t     *mbhandle,
   IN BOOLEAN                DisablePatching,
   IN BOOLEAN                IsRecovery,
+  IN LOADER_RAMDISK_TYPE    RamdiskType,
   IN LAST_BOOT_ENTRY        *LastBootEntry
 );
 
@@ -86,6 +144,51 @@ LoaderGetDecompressedRamdisk (
   OUT CPIO_NEWC_HEADER      **DecompressedRamdiskOut
 );
 
+EFI_STATUS
+LoaderWalkRamdisk (
+  IN bootimg_context_t      *context,
+  IN CPIO_WALKER            *Walker
+);
+
+VOID
+LoaderGetIoStats (
+  OUT LOADER_IO_STATS       *Stats
+);
+
+VOID
+LoaderResetIoStats (
+  VOID
+);
+
+// returns FALSE for devices which don't have to be prefetched
+typedef BOOLEAN (*LOADER_PREFETCH_FILTER)(EFI_HANDLE Handle, EFI_BLOCK_IO_PROTOCOL *BlockIo);
+
+EFI_STATUS
+LoaderPrefetchBlockIoHeaders (
+  IN LOADER_PREFETCH_FILTER  Filter
+);
+
+EFI_STATUS
+LoaderGetBlockIoHeaderCrc (
+  IN  EFI_BLOCK_IO_PROTOCOL *BlockIo,
+  OUT UINT32                *Crc
+);
+
+VOID
+LoaderFreePrefetchedHeaders (
+  VOID
+);
+
+EFI_STATUS
+LoaderGetLastBootProfile (
+  OUT LOADER_BOOT_PROFILE   *Profile
+);
+
+CONST CHAR8*
+LoaderBootPhaseName (
+  IN LOADER_BOOT_PHASE      Phase
+);
+
 VOID
 custom_init_context (
   IN bootimg_context_t *context
@@ -103,6 +206,12 @@ libboot_identify_file (
   IN bootimg_context_t *context
 );
 
+EFI_STATUS
+LoaderIdentifyBlockIo (
+  IN EFI_BLOCK_IO_PROTOCOL *BlockIo,
+  IN bootimg_context_t     *context
+);
+
 VOID
 LoaderAddPartitionItem (
   multiboot_handle_t     *mbhandle,
@@ -0,0 +1,106 @@
+#ifndef __INTERNAL_SPARSE_H__
+#define __INTERNAL_SPARSE_H__
+
+#define SPARSE_HEADER_MAGIC    0xed26ff3a
+
+#define CHUNK_TYPE_RAW         0xCAC1
+#define CHUNK_TYPE_FILL        0xCAC2
+#define CHUNK_TYPE_DONT_CARE   0xCAC3
+#define CHUNK_TYPE_CRC32       0xCAC4
+
+typedef struct {
+  UINT32 Magic;
+  UINT16 MajorVersion;
+  UINT16 MinorVersion;
+  UINT16 FileHeaderSize;
+  UINT16 ChunkHeaderSize;
+  UINT32 BlockSize;
+  UINT32 TotalBlocks;
+  UINT32 TotalChunks;
+  UINT32 ImageChecksum;
+} SPARSE_HEADER;
+
+typedef struct {
+  UINT16 ChunkType;
+  UINT16 Reserved1;
+  UINT32 ChunkSize;
+  UINT32 TotalSize;
+} SPARSE_CHUNK_HEADER;
+
+//
+// The output callbacks always continue where the previous one stopped.
+//
+typedef
+EFI_STATUS
+(*SPARSE_WRITE)(
+  IN VOID   *Context,
+  IN VOID   *Data,
+  IN UINTN  Size
+);
+
+typedef
+EFI_STATUS
+(*SPARSE_FILL)(
+  IN VOID   *Context,
+  IN UINT32 Pattern,
+  IN UINT64 Size
+);
+
+typedef
+EFI_STATUS
+(*SPARSE_SKIP)(
+  IN VOID   *Context,
+  IN UINT64 Size
+);
+
+typedef struct {
+  SPARSE_WRITE        Write;
+  SPARSE_FILL         Fill;
+  SPARSE_SKIP         Skip;
+  VOID                *Context;
+
+  UINTN               State;
+  SPARSE_HEADER       Header;
+  UINT32              ChunkIndex;
+  UINT32              ChunkType;
+  UINT64              ChunkFillSize;
+  UINT64              ChunkDataLeft;
+  UINT64              OutputBlocks;
+
+  // input bytes to ignore, used for header extensions
+  UINT64              InputSkip;
+
+  // collects headers and chunk values which are split across input buffers
+  UINT8               Buffer[sizeof(SPARSE_HEADER)];
+  UINTN               BufferSize;
+  UINTN               BufferUsed;
+} SPARSE_PARSER;
+
+BOOLEAN
+SparseIsImage (
+  IN CONST VOID *Data,
+  IN UINTN      Size
+);
+
+VOID
+SparseInit (
+  OUT SPARSE_PARSER *Parser,
+  IN  SPARSE_WRITE  Write,
+  IN  SPARSE_FILL   Fill,
+  IN  SPARSE_SKIP   Skip,
+  IN  VOID          *Context
+);
+
+EFI_STATUS
+SparseFeed (
+  IN SPARSE_PARSER *Parser,
+  IN VOID          *Data,
+  IN UINTN         Size
+);
+
+EFI_STATUS
+SparseFinish (
+  IN SPARSE_PARSER *Parser
+);
+
+#endif /* __INTERNAL_SPARSE_H__ */
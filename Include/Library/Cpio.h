@@ -40,9 +40,117 @@ CpioGetData (
 );
 CPIO_NEWC_HEADER *CpioGetLast (CPIO_NEWC_HEADER * hdr);
 CPIO_NEWC_HEADER *CpioGetByName (CPIO_NEWC_HEADER * hdr, CONST CHAR8 *name);
+UINTN CpioFindAll (CPIO_NEWC_HEADER * hdr, CONST CHAR8 **names,
+				     UINTN count, CPIO_NEWC_HEADER **results);
 
 CPIO_NEWC_HEADER *CpioCreateObj (CPIO_NEWC_HEADER * hdr,
 				     CONST CHAR8 *name, CONST VOID *data,
 				     UINTN data_size, UINT32 mode);
 
+//
+// hash index for archives which get searched more than a few times
+//
+typedef struct {
+  CONST CHAR8      *Name;
+  CPIO_NEWC_HEADER *Header;
+  VOID             *Data;
+  UINTN            Size;
+  UINT32           Hash;
+  UINT32           Next;
+} CPIO_INDEX_ENTRY;
+
+typedef struct {
+  CPIO_INDEX_ENTRY *Entries;
+  UINTN            Count;
+  UINT32           *Buckets;
+  UINTN            BucketMask;
+} CPIO_INDEX;
+
+EFI_STATUS
+CpioIndexBuild (
+  CPIO_NEWC_HEADER   *hdr,
+  CPIO_INDEX         *Index
+);
+
+VOID
+CpioIndexFree (
+  CPIO_INDEX         *Index
+);
+
+CONST CPIO_INDEX_ENTRY*
+CpioIndexFind (
+  CPIO_INDEX         *Index,
+  CONST CHAR8        *Name
+);
+
+UINTN
+CpioIndexFindAll (
+  CPIO_INDEX              *Index,
+  CONST CHAR8             **Names,
+  UINTN                   Count,
+  CONST CPIO_INDEX_ENTRY  **Results
+);
+
+//
+// streaming walker for archives which are not completely in memory
+//
+#define CPIO_WALK_WINDOW_SIZE 512
+
+typedef enum {
+  // skip the file data
+  CPIO_WALK_SKIP = 0,
+  // pass the file data to the data callback
+  CPIO_WALK_DATA,
+  // stop walking
+  CPIO_WALK_STOP,
+} CPIO_WALK_ACTION;
+
+typedef CPIO_WALK_ACTION (*CPIO_WALK_ENTRY_CALLBACK) (
+  VOID               *Context,
+  CONST CHAR8        *Name,
+  UINT32             Mode,
+  UINTN              FileSize
+);
+
+typedef EFI_STATUS (*CPIO_WALK_DATA_CALLBACK) (
+  VOID               *Context,
+  CONST VOID         *Data,
+  UINTN              Size
+);
+
+typedef struct {
+  CPIO_WALK_ENTRY_CALLBACK EntryCallback;
+  CPIO_WALK_DATA_CALLBACK  DataCallback;
+  VOID                     *Context;
+
+  UINTN                    State;
+  UINTN                    Fill;
+  UINTN                    Left;
+  UINTN                    Padding;
+  UINT32                   Mode;
+  UINTN                    FileSize;
+  BOOLEAN                  PassData;
+  CHAR8                    Window[CPIO_WALK_WINDOW_SIZE];
+} CPIO_WALKER;
+
+VOID
+CpioWalkInit (
+  CPIO_WALKER              *Walker,
+  CPIO_WALK_ENTRY_CALLBACK EntryCallback,
+  CPIO_WALK_DATA_CALLBACK  DataCallback,
+  VOID                     *Context
+);
+
+EFI_STATUS
+CpioWalkFeed (
+  CPIO_WALKER              *Walker,
+  CONST VOID               *Data,
+  UINTN                    Size
+);
+
+BOOLEAN
+CpioWalkDone (
+  CPIO_WALKER              *Walker
+);
+
 #endif /* ! CPIO_H */
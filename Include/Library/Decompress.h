@@ -36,4 +36,39 @@ typedef int (*decompress_fn) (unsigned char *inbuf, long len,
 decompress_fn decompress_method(const unsigned char *inbuf, long len,
 				const char **name);
 
+/* Uncompressed size stored in the headers or trailers, 0 if unknown.
+ * This is a hint only, concatenated streams may be larger.
+ */
+unsigned long decompress_get_size(const unsigned char *inbuf, long len);
+
+/* Decompress into outbuf, fails if the output doesn't fit.
+ * posp works like it does for decompress_fn, data after the stream is ignored.
+ */
+int decompress_bounded(decompress_fn fn, unsigned char *inbuf, long len,
+		       unsigned char *outbuf, unsigned long outlen,
+		       unsigned long *written, long *posp,
+		       void (*error)(char *x));
+
+/* Growable output for data of unknown size */
+struct decompress_chunk {
+	struct decompress_chunk *next;
+	unsigned long size;
+	unsigned char data[];
+};
+
+struct decompress_output {
+	struct decompress_chunk *head;
+	struct decompress_chunk *tail;
+	unsigned long size;
+};
+
+int decompress_chunked(decompress_fn fn, unsigned char *inbuf, long len,
+		       struct decompress_output *out, long *posp,
+		       void (*error)(char *x));
+
+void decompress_output_copy(const struct decompress_output *out,
+			    unsigned char *dst);
+
+void decompress_output_free(struct decompress_output *out);
+
 #endif
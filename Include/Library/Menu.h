@@ -205,6 +205,24 @@ VOID MenuShowProgressDialog(
   BOOLEAN ShowBackground
 );
 
+#define MENU_PROGRESS_NONE ((UINTN)-1)
+
+VOID
+MenuSetStatus (
+  CONST CHAR8* Text,
+  UINTN        Progress
+);
+
+VOID
+MenuInvalidateStatus (
+  VOID
+);
+
+VOID
+MenuUpdateStatus (
+  BOOLEAN Force
+);
+
 EFI_STATUS
 MenuShowSelectionDialog (
   MENU_OPTION* Menu
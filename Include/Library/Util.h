@@ -32,6 +32,15 @@
 #define STACKBUF_DMA_ALIGN(var, size) \
 	UINT8 __##var[(size) + CACHE_LINE]; UINT8 *var = (UINT8 *)(ROUNDUP((UINTN)__##var, CACHE_LINE))
 
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+  UINT32 State[8];
+  UINT64 Length;
+  UINT8  Block[64];
+  UINTN  BlockUsed;
+} UTIL_SHA256_CONTEXT;
+
 #define BASE64_ENCODED_SIZE(n) (ROUNDUP(4*((n)/3)+1, 4)+1)
 
 #define UtilBase64Encode __b64_ntop
@@ -292,4 +301,34 @@ UtilGetSystemMemoryResources (
   IN  LIST_ENTRY *ResourceList
   );
 
+UINT64
+UtilGetTimeUs (
+  VOID
+  );
+
+UINT32
+UtilCrc32 (
+  IN CONST VOID *Data,
+  IN UINTN      Size,
+  IN UINT32     Crc
+  );
+
+VOID
+UtilSha256Init (
+  OUT UTIL_SHA256_CONTEXT *Context
+  );
+
+VOID
+UtilSha256Update (
+  IN OUT UTIL_SHA256_CONTEXT *Context,
+  IN     CONST VOID          *Data,
+  IN     UINTN               Size
+  );
+
+VOID
+UtilSha256Final (
+  IN OUT UTIL_SHA256_CONTEXT *Context,
+  OUT    UINT8               *Digest
+  );
+
 #endif /* ! UTIL_H */
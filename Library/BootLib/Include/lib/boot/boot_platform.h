@@ -57,4 +57,13 @@ typedef INT16  boot_int16_t;
 typedef INT32  boot_int32_t;
 typedef INT64  boot_int64_t;
 
+// allocate memory at a final boot address before libboot_prepare runs
+void* libboot_platform_reserve(boot_uintn_t addr, boot_uintn_t sz);
+// returns 1 if ptr was in a reserved region, which has been released then
+int libboot_platform_unreserve(void* ptr);
+void libboot_platform_release_reserved(void);
+
+// number of failed allocations so far, tells running out of memory apart from other errors
+boot_uintn_t libboot_platform_alloc_failures(void);
+
 #endif // LIB_BOOT_PLATFORM_H
@@ -107,6 +107,10 @@ const char *libboot_qcdt_get_default_parser(void) {
 }
 
 void libboot_platform_memmove(void* dst, const void* src, boot_uintn_t num) {
+    // data which was loaded into its final location already
+    if(dst == src)
+        return;
+
     CopyMem(dst, src, num);
 }
 
@@ -118,14 +122,115 @@ void *libboot_platform_memset(void *s, int c, boot_uintn_t n) {
     return SetMem(s, (UINTN)n, (UINT8)c);
 }
 
+static boot_uintn_t alloc_failures = 0;
+
 void* libboot_platform_alloc(boot_uintn_t size) {
     void* mem = AllocatePool(size);
-    if(!mem)
+    if(!mem) {
+        alloc_failures++;
         libboot_format_error(LIBBOOT_ERROR_GROUP_COMMON, LIBBOOT_ERROR_COMMON_OUT_OF_MEMORY);
+    }
     return mem;
 }
 
+boot_uintn_t libboot_platform_alloc_failures(void) {
+    return alloc_failures;
+}
+
+//
+// regions at their final boot address which the loader filled before libboot_prepare.
+// bootalloc hands them out again so prepare doesn't have to copy the data
+//
+#define RESERVED_REGION_COUNT 4
+
+typedef struct {
+  boot_uintn_t addr;
+  boot_uintn_t size;
+} reserved_region_t;
+
+static reserved_region_t reserved_regions[RESERVED_REGION_COUNT];
+
+// finds the region containing a range, for pointers into reserved memory
+static reserved_region_t* reserved_region_find(boot_uintn_t addr, boot_uintn_t sz) {
+    UINTN i;
+
+    for(i=0; i<RESERVED_REGION_COUNT; i++) {
+        reserved_region_t *region = &reserved_regions[i];
+        if(region->size && addr >= region->addr && addr+sz <= region->addr+region->size)
+            return region;
+    }
+
+    return NULL;
+}
+
+// finds the reservation made for exactly this address. other ranges inside a
+// region belong to something else and must not be handed out or freed with it
+static reserved_region_t* reserved_region_find_exact(boot_uintn_t addr, boot_uintn_t sz) {
+    UINTN i;
+
+    for(i=0; i<RESERVED_REGION_COUNT; i++) {
+        reserved_region_t *region = &reserved_regions[i];
+        if(region->size && region->addr == addr && sz <= region->size)
+            return region;
+    }
+
+    return NULL;
+}
+
+void* libboot_platform_reserve(boot_uintn_t addr, boot_uintn_t sz) {
+    UINTN i;
+
+    for(i=0; i<RESERVED_REGION_COUNT; i++) {
+        reserved_region_t *region = &reserved_regions[i];
+        if(region->size)
+            continue;
+
+        UINTN      AlignedSize = sz;
+        UINTN      AddrOffset = 0;
+        EFI_PHYSICAL_ADDRESS AllocationAddress = AlignMemoryRange(addr, &AlignedSize, &AddrOffset, EFI_PAGE_SIZE);
+
+        EFI_STATUS Status = gBS->AllocatePages (AllocateAddress, EfiBootServicesData, EFI_SIZE_TO_PAGES(AlignedSize), &AllocationAddress);
+        if(EFI_ERROR(Status))
+            return NULL;
+
+        DEBUG((EFI_D_INFO, "reserve: 0x%08x - 0x%08x ; 0x%08x\n", addr, addr+sz, sz));
+        region->addr = addr;
+        region->size = sz;
+        return (VOID*)((UINTN)AllocationAddress)+AddrOffset;
+    }
+
+    return NULL;
+}
+
+static void reserved_region_release(reserved_region_t *region) {
+    FreeAlignedMemoryRange(region->addr, region->size, EFI_PAGE_SIZE);
+    region->addr = 0;
+    region->size = 0;
+}
+
+int libboot_platform_unreserve(void* ptr) {
+    reserved_region_t *region = reserved_region_find((boot_uintn_t)ptr, 1);
+    if(!region)
+        return 0;
+
+    reserved_region_release(region);
+    return 1;
+}
+
+void libboot_platform_release_reserved(void) {
+    UINTN i;
+
+    for(i=0; i<RESERVED_REGION_COUNT; i++) {
+        if(reserved_regions[i].size)
+            reserved_region_release(&reserved_regions[i]);
+    }
+}
+
 void libboot_platform_free(void *ptr) {
+    // reserved regions get released by bootfree or libboot_platform_release_reserved
+    if(ptr && reserved_region_find((boot_uintn_t)ptr, 1))
+        return;
+
     if(ptr)
         FreePool(ptr);
 }
@@ -205,6 +310,11 @@ void* libboot_platform_getmemory(void *pdata, libboot_platform_getmemory_callbac
 
 void* libboot_platform_bootalloc(boot_uintn_t addr, boot_uintn_t sz) {
   DEBUG((EFI_D_INFO, "alloc: 0x%08x - 0x%08x ; 0x%08x\n", addr, addr+sz, sz));
+
+  // already allocated and filled by the loader
+  if(reserved_region_find_exact(addr, sz))
+    return (VOID*)addr;
+
   UINTN      AlignedSize = sz;
   UINTN      AddrOffset = 0;
   EFI_PHYSICAL_ADDRESS AllocationAddress = AlignMemoryRange(addr, &AlignedSize, &AddrOffset, EFI_PAGE_SIZE);
@@ -217,6 +327,12 @@ void* libboot_platform_bootalloc(boot_uintn_t addr, boot_uintn_t sz) {
 }
 
 void libboot_platform_bootfree(boot_uintn_t addr, boot_uintn_t sz) {
+    reserved_region_t *region = reserved_region_find_exact(addr, sz);
+    if (region) {
+        reserved_region_release(region);
+        return;
+    }
+
     if (addr && sz)
         FreeAlignedMemoryRange(addr, sz, EFI_PAGE_SIZE);
 }
@@ -2,6 +2,7 @@
 #include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/PrintLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/Cpio.h>
 
 #define LIBUTIL_NOAROMA
@@ -97,22 +98,187 @@ CpioGetLast (
   return hdr;
 }
 
+//
+// finds all names in one pass over the archive.
+// results for names which weren't found are set to NULL
+//
+UINTN
+CpioFindAll (
+  CPIO_NEWC_HEADER *hdr,
+  CONST CHAR8      **names,
+  UINTN            count,
+  CPIO_NEWC_HEADER **results
+)
+{
+  UINTN found = 0;
+  UINTN i;
+
+  SetMem (results, count * sizeof (*results), 0);
+
+  while (found < count && CpioIsValid (hdr) && CpioHasNext (hdr)) {
+    CONST CHAR8  *nameptr = (CONST CHAR8 *) (hdr + 1);
+
+    for (i = 0; i < count; i++) {
+      if (!results[i] && !AsciiStrCmp (nameptr, names[i])) {
+        results[i] = hdr;
+        found++;
+      }
+    }
+
+    hdr = (CPIO_NEWC_HEADER *) (((CHAR8 *) hdr) + CpioGetObjSize (hdr));
+  }
+
+  return found;
+}
+
 CPIO_NEWC_HEADER*
 CpioGetByName (
   CPIO_NEWC_HEADER *hdr,
   CONST CHAR8        *name
 )
 {
-  while (CpioIsValid (hdr) && CpioHasNext (hdr)) {
-    hdr = (CPIO_NEWC_HEADER *) (((CHAR8 *) hdr) + CpioGetObjSize (hdr));
-    CONST CHAR8  *nameptr = (CONST CHAR8 *) (hdr + 1);
-    if (!AsciiStrCmp(nameptr, name))
-      return hdr;
+  CPIO_NEWC_HEADER *result;
+
+  CpioFindAll (hdr, &name, 1, &result);
+
+  return result;
+}
+
+#define CPIO_INDEX_NONE MAX_UINT32
+
+STATIC
+UINT32
+CpioIndexHash (
+  CONST CHAR8 *Name
+)
+{
+  UINT32 Hash = 2166136261U;
+
+  // FNV-1a
+  while (*Name) {
+    Hash ^= (UINT8) *Name++;
+    Hash *= 16777619U;
+  }
+
+  return Hash;
+}
+
+//
+// index all objects of an archive. the archive has to stay valid and unmodified
+// for as long as the index is used
+//
+EFI_STATUS
+CpioIndexBuild (
+  CPIO_NEWC_HEADER   *hdr,
+  CPIO_INDEX         *Index
+)
+{
+  EFI_STATUS       Status;
+  CPIO_NEWC_HEADER *cur;
+  CPIO_INDEX_ENTRY *Entry;
+  UINTN            Count;
+  UINTN            BucketCount;
+  UINTN            i;
+
+  SetMem (Index, sizeof (*Index), 0);
+
+  // count objects
+  Count = 0;
+  for (cur = hdr; CpioIsValid (cur) && CpioHasNext (cur); cur = (CPIO_NEWC_HEADER *) (((CHAR8 *) cur) + CpioGetObjSize (cur))) {
+    Count++;
+  }
+
+  // keep the load factor below 1
+  for (BucketCount = 16; BucketCount < Count; BucketCount <<= 1);
+
+  Index->Entries = AllocatePool (MAX (Count, 1) * sizeof (*Index->Entries));
+  Index->Buckets = AllocatePool (BucketCount * sizeof (*Index->Buckets));
+  if (Index->Entries == NULL || Index->Buckets == NULL) {
+    CpioIndexFree (Index);
+    return EFI_OUT_OF_RESOURCES;
+  }
+  SetMem (Index->Buckets, BucketCount * sizeof (*Index->Buckets), 0xff);
+  Index->BucketMask = BucketCount - 1;
+
+  for (cur = hdr; Index->Count < Count; cur = (CPIO_NEWC_HEADER *) (((CHAR8 *) cur) + CpioGetObjSize (cur))) {
+    Entry = &Index->Entries[Index->Count];
+    Entry->Header = cur;
+    Entry->Name = (CONST CHAR8 *) (cur + 1);
+    Entry->Hash = CpioIndexHash (Entry->Name);
+
+    Status = CpioGetData (cur, &Entry->Data, &Entry->Size);
+    if (EFI_ERROR (Status)) {
+      CpioIndexFree (Index);
+      return Status;
+    }
+
+    Index->Count++;
+  }
+
+  // insert backwards so duplicate names resolve to the first object like a linear search
+  for (i = Count; i-- > 0;) {
+    Entry = &Index->Entries[i];
+    Entry->Next = Index->Buckets[Entry->Hash & Index->BucketMask];
+    Index->Buckets[Entry->Hash & Index->BucketMask] = (UINT32) i;
+  }
+
+  return EFI_SUCCESS;
+}
+
+VOID
+CpioIndexFree (
+  CPIO_INDEX         *Index
+)
+{
+  if (Index->Entries)
+    FreePool (Index->Entries);
+  if (Index->Buckets)
+    FreePool (Index->Buckets);
+
+  SetMem (Index, sizeof (*Index), 0);
+}
+
+CONST CPIO_INDEX_ENTRY*
+CpioIndexFind (
+  CPIO_INDEX         *Index,
+  CONST CHAR8        *Name
+)
+{
+  UINT32 Hash;
+  UINT32 Cur;
+
+  if (Index->Buckets == NULL)
+    return NULL;
+
+  Hash = CpioIndexHash (Name);
+  for (Cur = Index->Buckets[Hash & Index->BucketMask]; Cur != CPIO_INDEX_NONE; Cur = Index->Entries[Cur].Next) {
+    if (Index->Entries[Cur].Hash == Hash && !AsciiStrCmp (Index->Entries[Cur].Name, Name))
+      return &Index->Entries[Cur];
   }
 
   return NULL;
 }
 
+UINTN
+CpioIndexFindAll (
+  CPIO_INDEX              *Index,
+  CONST CHAR8             **Names,
+  UINTN                   Count,
+  CONST CPIO_INDEX_ENTRY  **Results
+)
+{
+  UINTN Found = 0;
+  UINTN i;
+
+  for (i = 0; i < Count; i++) {
+    Results[i] = CpioIndexFind (Index, Names[i]);
+    if (Results[i])
+      Found++;
+  }
+
+  return Found;
+}
+
 CPIO_NEWC_HEADER*
 CpioCreateObj (
   CPIO_NEWC_HEADER   *hdr,
@@ -157,3 +323,157 @@ CpioCreateObj (
 
   return (CPIO_NEWC_HEADER *) (dataptr + ALIGN_VALUE (data_size, 4));
 }
+
+enum {
+  CPIO_WALK_STATE_HEADER = 0,
+  CPIO_WALK_STATE_NAME,
+  CPIO_WALK_STATE_NAME_PADDING,
+  CPIO_WALK_STATE_DATA,
+  CPIO_WALK_STATE_DATA_PADDING,
+  CPIO_WALK_STATE_DONE,
+};
+
+VOID
+CpioWalkInit (
+  CPIO_WALKER              *Walker,
+  CPIO_WALK_ENTRY_CALLBACK EntryCallback,
+  CPIO_WALK_DATA_CALLBACK  DataCallback,
+  VOID                     *Context
+)
+{
+  SetMem (Walker, sizeof (*Walker), 0);
+  Walker->EntryCallback = EntryCallback;
+  Walker->DataCallback = DataCallback;
+  Walker->Context = Context;
+  Walker->State = CPIO_WALK_STATE_HEADER;
+  Walker->Left = sizeof (CPIO_NEWC_HEADER);
+}
+
+BOOLEAN
+CpioWalkDone (
+  CPIO_WALKER              *Walker
+)
+{
+  return Walker->State == CPIO_WALK_STATE_DONE;
+}
+
+STATIC
+VOID
+CpioWalkNameDone (
+  CPIO_WALKER              *Walker
+)
+{
+  CPIO_WALK_ACTION Action;
+
+  // names which don't fit into the window get truncated
+  Walker->Window[MIN (Walker->Fill, CPIO_WALK_WINDOW_SIZE - 1)] = 0;
+
+  if (!AsciiStrCmp (Walker->Window, CPIO_TRAILER)) {
+    Walker->State = CPIO_WALK_STATE_DONE;
+    return;
+  }
+
+  Action = Walker->EntryCallback (Walker->Context, Walker->Window, Walker->Mode, Walker->FileSize);
+  if (Action == CPIO_WALK_STOP) {
+    Walker->State = CPIO_WALK_STATE_DONE;
+    return;
+  }
+
+  Walker->PassData = (Action == CPIO_WALK_DATA && Walker->DataCallback);
+  Walker->State = CPIO_WALK_STATE_NAME_PADDING;
+  Walker->Left = Walker->Padding;
+}
+
+//
+// feed the next part of the archive.
+// returns EFI_END_OF_FILE once the trailer was reached or a callback stopped the walk
+//
+EFI_STATUS
+CpioWalkFeed (
+  CPIO_WALKER              *Walker,
+  CONST VOID               *Data,
+  UINTN                    Size
+)
+{
+  EFI_STATUS       Status;
+  CONST UINT8      *Ptr = Data;
+  CPIO_NEWC_HEADER *hdr;
+  UINT32           namesize;
+  UINTN            Count;
+
+  while (Walker->State != CPIO_WALK_STATE_DONE) {
+    // finish states which don't need any more data
+    if (Walker->Left == 0) {
+      switch (Walker->State) {
+        case CPIO_WALK_STATE_HEADER:
+          hdr = (CPIO_NEWC_HEADER *) Walker->Window;
+          if (!CpioIsValid (hdr)) {
+            Walker->State = CPIO_WALK_STATE_DONE;
+            return EFI_VOLUME_CORRUPTED;
+          }
+
+          namesize = CpioStrToUl (hdr->c_namesize);
+          Walker->Mode = CpioStrToUl (hdr->c_mode);
+          Walker->FileSize = CpioStrToUl (hdr->c_filesize);
+          Walker->Padding = ALIGN_VALUE (sizeof (*hdr) + namesize, 4) - (sizeof (*hdr) + namesize);
+          Walker->State = CPIO_WALK_STATE_NAME;
+          Walker->Left = namesize;
+          Walker->Fill = 0;
+          break;
+
+        case CPIO_WALK_STATE_NAME:
+          CpioWalkNameDone (Walker);
+          break;
+
+        case CPIO_WALK_STATE_NAME_PADDING:
+          Walker->State = CPIO_WALK_STATE_DATA;
+          Walker->Left = Walker->FileSize;
+          break;
+
+        case CPIO_WALK_STATE_DATA:
+          Walker->State = CPIO_WALK_STATE_DATA_PADDING;
+          Walker->Left = ALIGN_VALUE (Walker->FileSize, 4) - Walker->FileSize;
+          break;
+
+        case CPIO_WALK_STATE_DATA_PADDING:
+          Walker->State = CPIO_WALK_STATE_HEADER;
+          Walker->Left = sizeof (CPIO_NEWC_HEADER);
+          Walker->Fill = 0;
+          break;
+      }
+      continue;
+    }
+
+    if (Size == 0)
+      return EFI_SUCCESS;
+
+    Count = MIN (Size, Walker->Left);
+
+    switch (Walker->State) {
+      case CPIO_WALK_STATE_HEADER:
+      case CPIO_WALK_STATE_NAME:
+        // keep as much as fits into the window
+        if (Walker->Fill < CPIO_WALK_WINDOW_SIZE) {
+          CopyMem (Walker->Window + Walker->Fill, Ptr, MIN (Count, CPIO_WALK_WINDOW_SIZE - Walker->Fill));
+        }
+        Walker->Fill += Count;
+        break;
+
+      case CPIO_WALK_STATE_DATA:
+        if (Walker->PassData) {
+          Status = Walker->DataCallback (Walker->Context, Ptr, Count);
+          if (EFI_ERROR (Status)) {
+            Walker->State = CPIO_WALK_STATE_DONE;
+            return Status;
+          }
+        }
+        break;
+    }
+
+    Ptr += Count;
+    Size -= Count;
+    Walker->Left -= Count;
+  }
+
+  return EFI_END_OF_FILE;
+}
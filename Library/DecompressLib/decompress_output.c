@@ -0,0 +1,244 @@
+/*
+ * decompress_output.c
+ *
+ * Output size discovery and output buffer helpers for the
+ * Linux decompressors.
+ */
+
+#include <linuxcompat.h>
+#include <Library/Decompress.h>
+
+#define DECOMPRESS_CHUNK_SIZE (1024*1024)
+
+static unsigned long get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+/* gzip: ISIZE trailer, the size modulo 2^32 of the last member */
+static unsigned long gzip_get_size(const unsigned char *inbuf, long len)
+{
+	if (len < 18)
+		return 0;
+
+	return get_le32(inbuf + len - 4);
+}
+
+/* lzma: 64bit size in the header, all ones means unknown */
+static unsigned long lzma_get_size(const unsigned char *inbuf, long len)
+{
+	unsigned long lo, hi;
+
+	if (len < 13)
+		return 0;
+
+	lo = get_le32(inbuf + 5);
+	hi = get_le32(inbuf + 9);
+	if (hi != 0)
+		return 0;
+
+	return lo;
+}
+
+static int xz_read_vli(const unsigned char **p, const unsigned char *end,
+		       uint64_t *value)
+{
+	int i;
+
+	*value = 0;
+	for (i = 0; i < 9 && *p < end; i++) {
+		unsigned char byte = *(*p)++;
+
+		*value |= (uint64_t)(byte & 0x7f) << (i * 7);
+		if (!(byte & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+/* xz: sum of the uncompressed sizes in the index of the last stream */
+static unsigned long xz_get_size(const unsigned char *inbuf, long len)
+{
+	const unsigned char *footer;
+	const unsigned char *index;
+	const unsigned char *end;
+	uint64_t records, unpadded, uncompressed, total;
+	unsigned long index_size;
+
+	/* skip stream padding */
+	while (len >= 4 && !get_le32(inbuf + len - 4))
+		len -= 4;
+
+	if (len < 12 + 12)
+		return 0;
+
+	footer = inbuf + len - 12;
+	if (footer[10] != 'Y' || footer[11] != 'Z')
+		return 0;
+
+	index_size = (get_le32(footer + 4) + 1) * 4;
+	if (index_size > (unsigned long)len - 12 - 12)
+		return 0;
+
+	index = footer - index_size;
+	end = footer;
+	if (*index++ != 0x00)
+		return 0;
+
+	if (xz_read_vli(&index, end, &records))
+		return 0;
+
+	total = 0;
+	while (records--) {
+		if (xz_read_vli(&index, end, &unpadded))
+			return 0;
+		if (xz_read_vli(&index, end, &uncompressed))
+			return 0;
+		total += uncompressed;
+	}
+
+	if (total > (unsigned long)~0UL)
+		return 0;
+
+	return (unsigned long)total;
+}
+
+/*
+ * Returns the uncompressed size stored in the compressed data or 0 if the
+ * format doesn't store it. This is a hint only: concatenated gzip members
+ * or xz streams only report the size of the last one.
+ */
+unsigned long decompress_get_size(const unsigned char *inbuf, long len)
+{
+	if (len < 2)
+		return 0;
+
+	if (inbuf[0] == 0x1f && (inbuf[1] == 0x8b || inbuf[1] == 0x9e))
+		return gzip_get_size(inbuf, len);
+	if (inbuf[0] == 0x5d && inbuf[1] == 0x00)
+		return lzma_get_size(inbuf, len);
+	if (inbuf[0] == 0xfd && inbuf[1] == 0x37)
+		return xz_get_size(inbuf, len);
+
+	/* bzip2, lzo and legacy lz4 don't store the size */
+	return 0;
+}
+
+/* the decompressors don't pass a context to flush */
+static unsigned char *bounded_buf;
+static unsigned long bounded_len;
+static unsigned long bounded_pos;
+static struct decompress_output *chunked_out;
+
+static long bounded_flush(void *data, unsigned long size)
+{
+	if (size > bounded_len - bounded_pos)
+		return -1;
+
+	memcpy(bounded_buf + bounded_pos, data, size);
+	bounded_pos += size;
+
+	return size;
+}
+
+int decompress_bounded(decompress_fn fn, unsigned char *inbuf, long len,
+		       unsigned char *outbuf, unsigned long outlen,
+		       unsigned long *written, long *posp,
+		       void (*error)(char *x))
+{
+	int rc;
+
+	bounded_buf = outbuf;
+	bounded_len = outlen;
+	bounded_pos = 0;
+
+	rc = fn(inbuf, len, NULL, bounded_flush, NULL, posp, error);
+
+	*written = bounded_pos;
+	bounded_buf = NULL;
+
+	return rc;
+}
+
+static long chunked_flush(void *data, unsigned long size)
+{
+	struct decompress_output *out = chunked_out;
+	unsigned char *src = data;
+	unsigned long left = size;
+
+	while (left) {
+		struct decompress_chunk *chunk = out->tail;
+		unsigned long n;
+
+		if (!chunk || chunk->size == DECOMPRESS_CHUNK_SIZE) {
+			chunk = malloc(sizeof(*chunk) + DECOMPRESS_CHUNK_SIZE);
+			if (!chunk)
+				return -1;
+
+			chunk->next = NULL;
+			chunk->size = 0;
+			if (out->tail)
+				out->tail->next = chunk;
+			else
+				out->head = chunk;
+			out->tail = chunk;
+		}
+
+		n = min_t(unsigned long, left, DECOMPRESS_CHUNK_SIZE - chunk->size);
+		memcpy(chunk->data + chunk->size, src, n);
+		chunk->size += n;
+		out->size += n;
+		src += n;
+		left -= n;
+	}
+
+	return size;
+}
+
+int decompress_chunked(decompress_fn fn, unsigned char *inbuf, long len,
+		       struct decompress_output *out, long *posp,
+		       void (*error)(char *x))
+{
+	int rc;
+
+	out->head = NULL;
+	out->tail = NULL;
+	out->size = 0;
+
+	chunked_out = out;
+	rc = fn(inbuf, len, NULL, chunked_flush, NULL, posp, error);
+	chunked_out = NULL;
+
+	if (rc)
+		decompress_output_free(out);
+
+	return rc;
+}
+
+void decompress_output_copy(const struct decompress_output *out,
+			    unsigned char *dst)
+{
+	const struct decompress_chunk *chunk;
+
+	for (chunk = out->head; chunk; chunk = chunk->next) {
+		memcpy(dst, chunk->data, chunk->size);
+		dst += chunk->size;
+	}
+}
+
+void decompress_output_free(struct decompress_output *out)
+{
+	struct decompress_chunk *chunk = out->head;
+
+	while (chunk) {
+		struct decompress_chunk *next = chunk->next;
+
+		free(chunk);
+		chunk = next;
+	}
+
+	out->head = NULL;
+	out->tail = NULL;
+	out->size = 0;
+}
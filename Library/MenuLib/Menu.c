@@ -3,6 +3,7 @@
 #include "Menu.h"
 #include <Library/UefiLib.h>
 #include <Library/TimerLib.h>
+#include <Library/PrintLib.h>
 
 #define ENABLE_PERFORMANCE_DEBUGGING 0
 
@@ -1141,6 +1142,9 @@ INT32 MenuShowDialog(
   if(Initialized==FALSE)
     return -1;
 
+  // the status dialog has to redraw the menu after this
+  MenuInvalidateStatus();
+
   UINT32 OldMode = UINT32_MAX;
   if(mGop->Mode->Mode!=mOurMode) {
     OldMode = mGop->Mode->Mode;
@@ -1322,19 +1326,13 @@ VOID MenuShowMessage (
   MenuShowDialog(Title, Message, "OK", NULL);
 }
 
-VOID MenuShowProgressDialog (
+STATIC
+VOID
+MenuDrawProgressDialog (
   CONST CHAR8* Text,
-  BOOLEAN ShowBackground
+  UINTN        Progress
 )
 {
-  if(!Initialized) {
-    return;
-  }
-
-  if(ShowBackground) {
-    MenuDrawDarkBackground();
-  }
-
   int dialog_w = dc->w-libaroma_dp(48);
   int dialog_h = libaroma_dp(88);
   int dialog_x = libaroma_dp(24);
@@ -1377,9 +1375,103 @@ VOID MenuShowProgressDialog (
 
   libaroma_text_free(txt);
 
+  /* progress bar */
+  if (Progress != MENU_PROGRESS_NONE) {
+    int bar_x = dialog_x + libaroma_dp(16);
+    int bar_w = dialog_w - libaroma_dp(32);
+    int bar_h = libaroma_dp(4);
+    int bar_y = dialog_y + dialog_h - libaroma_dp(16) - bar_h;
+
+    libaroma_draw_rect(dc, bar_x, bar_y, bar_w, bar_h, colorSeparator, 0xff);
+    libaroma_draw_rect(dc, bar_x, bar_y, (bar_w * (int)MIN(Progress, 100)) / 100, bar_h, colorAccent, 0xff);
+  }
+}
+
+VOID MenuShowProgressDialog (
+  CONST CHAR8* Text,
+  BOOLEAN ShowBackground
+)
+{
+  if(!Initialized) {
+    return;
+  }
+
+  // the status dialog has to redraw the menu after this
+  MenuInvalidateStatus();
+
+  if(ShowBackground) {
+    MenuDrawDarkBackground();
+  }
+
+  MenuDrawProgressDialog(Text, MENU_PROGRESS_NONE);
+
   libaroma_sync(); 
 }
 
+//
+// rate limited status dialog, only renders when something changed
+//
+#define MENU_STATUS_FRAME_INTERVAL_MS 100
+
+STATIC CHAR8   mStatusText[100];
+STATIC UINTN   mStatusProgress = MENU_PROGRESS_NONE;
+STATIC BOOLEAN mStatusDirty = FALSE;
+STATIC BOOLEAN mStatusRedrawMenu = FALSE;
+STATIC UINT64  mStatusLastFrame = 0;
+
+VOID
+MenuSetStatus (
+  CONST CHAR8* Text,
+  UINTN        Progress
+)
+{
+  if (Progress == mStatusProgress && !AsciiStrCmp(Text, mStatusText))
+    return;
+
+  AsciiSPrint(mStatusText, sizeof(mStatusText), "%a", Text);
+  mStatusProgress = Progress;
+  mStatusDirty = TRUE;
+}
+
+VOID
+MenuInvalidateStatus (
+  VOID
+)
+{
+  mStatusRedrawMenu = TRUE;
+  mStatusDirty = TRUE;
+}
+
+VOID
+MenuUpdateStatus (
+  BOOLEAN Force
+)
+{
+  UINT64 Now;
+
+  if(!Initialized || !mStatusDirty) {
+    return;
+  }
+
+  Now = GetTimeMs();
+  if (!Force && Now - mStatusLastFrame < MENU_STATUS_FRAME_INTERVAL_MS) {
+    return;
+  }
+
+  // somebody else drew over our dialog
+  if (mStatusRedrawMenu) {
+    RenderActiveMenu();
+    MenuDrawDarkBackground();
+    mStatusRedrawMenu = FALSE;
+  }
+
+  MenuDrawProgressDialog(mStatusText, mStatusProgress);
+  libaroma_sync();
+
+  mStatusDirty = FALSE;
+  mStatusLastFrame = Now;
+}
+
 STATIC
 VOID
 MenuAddScreenShot (
@@ -1563,6 +1655,9 @@ MenuShowSelectionDialog (
   Menu->ItemFlags       = 0;
   BuildAromaMenu(Menu);
 
+  // the status dialog has to redraw the menu after this
+  MenuInvalidateStatus();
+
   MenuDrawDarkBackground();
 
   /* draw fake shadow */
@@ -7,6 +7,7 @@
 #include <Library/UefiLib.h>
 #include <Library/PrintLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/Decompress.h>
 #include <Protocol/LoadedImage.h>
 
 #define LIBUTIL_NOAROMA
@@ -16,6 +17,18 @@
 
 STATIC CPIO_NEWC_HEADER *gRamdisk = NULL;
 STATIC UINTN            gRamdiskSize = 0;
+STATIC CPIO_INDEX       gRamdiskIndex;
+
+// assets can be stored compressed with one of these suffixes.
+// they get decompressed on first access and stay cached
+STATIC CONST CHAR8 *mCompressedSuffixes[] = { ".lz4", ".gz" };
+
+typedef struct {
+  VOID  *Data;
+  UINTN Size;
+} RAMDISK_FILE_CACHE;
+
+STATIC RAMDISK_FILE_CACHE *gRamdiskFileCache = NULL;
 
 STATIC
 VOID
@@ -36,6 +49,117 @@ StripFileName (
 }
 
 
+STATIC
+VOID
+DecompressError (
+  CHAR8 *Str
+)
+{
+  DEBUG((EFI_D_ERROR, "UEFIRamdisk: %a\n", Str));
+}
+
+STATIC
+EFI_STATUS
+DecompressFile (
+  CONST CPIO_INDEX_ENTRY *Entry,
+  VOID                   **Ptr,
+  UINTN                  *Size
+)
+{
+  CONST CHAR8              *DecompName;
+  decompress_fn            Decompressor;
+  struct decompress_output Output;
+  unsigned long            SizeHint;
+  unsigned long            Written;
+  UINT8                    *Buffer;
+
+  Decompressor = decompress_method(Entry->Data, Entry->Size, &DecompName);
+  if (Decompressor==NULL)
+    return EFI_UNSUPPORTED;
+
+  // gzip stores the size, so we can decompress directly into the final buffer
+  SizeHint = decompress_get_size(Entry->Data, Entry->Size);
+  if (SizeHint) {
+    Buffer = AllocatePool(SizeHint);
+    if (Buffer==NULL)
+      return EFI_OUT_OF_RESOURCES;
+
+    if (!decompress_bounded(Decompressor, Entry->Data, Entry->Size, Buffer, SizeHint, &Written, NULL, DecompressError)) {
+      *Ptr = Buffer;
+      *Size = Written;
+      return EFI_SUCCESS;
+    }
+
+    FreePool(Buffer);
+  }
+
+  if (decompress_chunked(Decompressor, Entry->Data, Entry->Size, &Output, NULL, DecompressError))
+    return EFI_LOAD_ERROR;
+
+  Buffer = AllocatePool(MAX(Output.size, 1));
+  if (Buffer==NULL) {
+    decompress_output_free(&Output);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  decompress_output_copy(&Output, Buffer);
+  *Ptr = Buffer;
+  *Size = Output.size;
+  decompress_output_free(&Output);
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+GetCompressedFile (
+  CONST CHAR8 *Path,
+  VOID        **Ptr,
+  UINTN       *Size
+)
+{
+  EFI_STATUS             Status;
+  CHAR8                  CompressedPath[256];
+  CONST CPIO_INDEX_ENTRY *Entry = NULL;
+  RAMDISK_FILE_CACHE     *Cache;
+  UINTN                  Index;
+
+  for (Index=0; Index<sizeof(mCompressedSuffixes)/sizeof(mCompressedSuffixes[0]); Index++) {
+    if (AsciiStrLen(Path) + AsciiStrLen(mCompressedSuffixes[Index]) >= sizeof(CompressedPath))
+      return EFI_NOT_FOUND;
+
+    AsciiSPrint(CompressedPath, sizeof(CompressedPath), "%a%a", Path, mCompressedSuffixes[Index]);
+    Entry = CpioIndexFind(&gRamdiskIndex, CompressedPath);
+    if (Entry)
+      break;
+  }
+  if (Entry==NULL)
+    return EFI_NOT_FOUND;
+
+  if (gRamdiskFileCache==NULL) {
+    gRamdiskFileCache = AllocateZeroPool(gRamdiskIndex.Count * sizeof(*gRamdiskFileCache));
+    if (gRamdiskFileCache==NULL)
+      return EFI_OUT_OF_RESOURCES;
+  }
+
+  // decompress on first access
+  Cache = &gRamdiskFileCache[Entry - gRamdiskIndex.Entries];
+  if (Cache->Data==NULL) {
+    Status = DecompressFile(Entry, &Cache->Data, &Cache->Size);
+    if (EFI_ERROR(Status)) {
+      DEBUG((EFI_D_ERROR, "UEFIRamdisk: can't decompress %a: %r\n", CompressedPath, Status));
+      return Status;
+    }
+  }
+
+  if (Ptr)
+    *Ptr = Cache->Data;
+  if (Size)
+    *Size = Cache->Size;
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 EFIAPI
 UEFIRamdiskGetFile (
@@ -47,11 +171,25 @@ UEFIRamdiskGetFile (
   if (gRamdisk==NULL)
     return EFI_UNSUPPORTED;
 
-  CPIO_NEWC_HEADER* CpioFile = CpioGetByName(gRamdisk, Path);
-  if (!CpioFile)
-    return EFI_NOT_FOUND;
-  
-  return CpioGetData(CpioFile, Ptr, Size);
+  // the index may be missing if we were low on memory
+  if (gRamdiskIndex.Entries==NULL) {
+    CPIO_NEWC_HEADER* CpioFile = CpioGetByName(gRamdisk, Path);
+    if (!CpioFile)
+      return EFI_NOT_FOUND;
+
+    return CpioGetData(CpioFile, Ptr, Size);
+  }
+
+  CONST CPIO_INDEX_ENTRY *Entry = CpioIndexFind(&gRamdiskIndex, Path);
+  if (!Entry)
+    return GetCompressedFile(Path, Ptr, Size);
+
+  if (Ptr)
+    *Ptr = Entry->Data;
+  if (Size)
+    *Size = Entry->Size;
+
+  return EFI_SUCCESS;
 }
 
 EFI_STATUS
@@ -80,6 +218,7 @@ UEFIRamdiskLibConstructor (
 
     gRamdisk = Ramdisk;
     gRamdiskSize = RamdiskSize;
+    CpioIndexBuild(gRamdisk, &gRamdiskIndex);
 
     return EFI_SUCCESS;
   }
@@ -173,6 +312,7 @@ NEXT:
 
   gRamdisk = Ramdisk;
   gRamdiskSize = FileSize;
+  CpioIndexBuild(gRamdisk, &gRamdiskIndex);
   Status = EFI_SUCCESS;
 
 Done:
@@ -0,0 +1,246 @@
+#include <Library/Util.h>
+#include <Library/BaseMemoryLib.h>
+
+//
+// CRC32 using the polynomial from IEEE-802.3
+// the table generation is the same as in xz_crc32, but we use
+// eight tables so we can process 8 bytes per iteration
+//
+STATIC UINT32  mCrc32Table[8][256];
+STATIC BOOLEAN mCrc32TableReady = FALSE;
+
+STATIC
+VOID
+Crc32InitTable (
+  VOID
+  )
+{
+  CONST UINT32 Poly = 0xEDB88320;
+  UINT32       Index;
+  UINT32       Bit;
+  UINT32       Slice;
+  UINT32       r;
+
+  for (Index = 0; Index < 256; Index++) {
+    r = Index;
+    for (Bit = 0; Bit < 8; Bit++)
+      r = (r >> 1) ^ (Poly & ~((r & 1) - 1));
+
+    mCrc32Table[0][Index] = r;
+  }
+
+  for (Index = 0; Index < 256; Index++) {
+    r = mCrc32Table[0][Index];
+    for (Slice = 1; Slice < 8; Slice++) {
+      r = (r >> 8) ^ mCrc32Table[0][r & 0xFF];
+      mCrc32Table[Slice][Index] = r;
+    }
+  }
+
+  mCrc32TableReady = TRUE;
+}
+
+UINT32
+UtilCrc32 (
+  IN CONST VOID *Data,
+  IN UINTN      Size,
+  IN UINT32     Crc
+  )
+{
+  CONST UINT8 *Buf = Data;
+  UINT32      One;
+  UINT32      Two;
+
+  if (!mCrc32TableReady)
+    Crc32InitTable();
+
+  Crc = ~Crc;
+
+  // align the input for the word loads
+  while (Size != 0 && ((UINTN)Buf & 3) != 0) {
+    Crc = mCrc32Table[0][(Crc ^ *Buf++) & 0xFF] ^ (Crc >> 8);
+    Size--;
+  }
+
+  // slice-by-8, this assumes a little endian cpu
+  while (Size >= 8) {
+    One = *(CONST UINT32*)Buf ^ Crc;
+    Two = *(CONST UINT32*)(Buf + 4);
+    Crc = mCrc32Table[7][One & 0xFF] ^
+          mCrc32Table[6][(One >> 8) & 0xFF] ^
+          mCrc32Table[5][(One >> 16) & 0xFF] ^
+          mCrc32Table[4][One >> 24] ^
+          mCrc32Table[3][Two & 0xFF] ^
+          mCrc32Table[2][(Two >> 8) & 0xFF] ^
+          mCrc32Table[1][(Two >> 16) & 0xFF] ^
+          mCrc32Table[0][Two >> 24];
+    Buf += 8;
+    Size -= 8;
+  }
+
+  while (Size != 0) {
+    Crc = mCrc32Table[0][(Crc ^ *Buf++) & 0xFF] ^ (Crc >> 8);
+    Size--;
+  }
+
+  return ~Crc;
+}
+
+//
+// SHA-256 as described in FIPS 180-4
+//
+STATIC CONST UINT32 mSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+STATIC
+VOID
+Sha256Transform (
+  IN OUT UTIL_SHA256_CONTEXT *Context,
+  IN     CONST UINT8         *Block
+  )
+{
+  UINT32 W[64];
+  UINT32 a, b, c, d, e, f, g, h;
+  UINT32 T1, T2;
+  UINTN  Index;
+
+  for (Index = 0; Index < 16; Index++) {
+    W[Index] = ((UINT32)Block[Index * 4] << 24) |
+               ((UINT32)Block[Index * 4 + 1] << 16) |
+               ((UINT32)Block[Index * 4 + 2] << 8) |
+               ((UINT32)Block[Index * 4 + 3]);
+  }
+  for (Index = 16; Index < 64; Index++) {
+    W[Index] = (ROR32(W[Index - 2], 17) ^ ROR32(W[Index - 2], 19) ^ (W[Index - 2] >> 10)) + W[Index - 7] +
+               (ROR32(W[Index - 15], 7) ^ ROR32(W[Index - 15], 18) ^ (W[Index - 15] >> 3)) + W[Index - 16];
+  }
+
+  a = Context->State[0];
+  b = Context->State[1];
+  c = Context->State[2];
+  d = Context->State[3];
+  e = Context->State[4];
+  f = Context->State[5];
+  g = Context->State[6];
+  h = Context->State[7];
+
+  for (Index = 0; Index < 64; Index++) {
+    T1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + mSha256K[Index] + W[Index];
+    T2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + T1;
+    d = c;
+    c = b;
+    b = a;
+    a = T1 + T2;
+  }
+
+  Context->State[0] += a;
+  Context->State[1] += b;
+  Context->State[2] += c;
+  Context->State[3] += d;
+  Context->State[4] += e;
+  Context->State[5] += f;
+  Context->State[6] += g;
+  Context->State[7] += h;
+}
+
+VOID
+UtilSha256Init (
+  OUT UTIL_SHA256_CONTEXT *Context
+  )
+{
+  Context->State[0] = 0x6a09e667;
+  Context->State[1] = 0xbb67ae85;
+  Context->State[2] = 0x3c6ef372;
+  Context->State[3] = 0xa54ff53a;
+  Context->State[4] = 0x510e527f;
+  Context->State[5] = 0x9b05688c;
+  Context->State[6] = 0x1f83d9ab;
+  Context->State[7] = 0x5be0cd19;
+  Context->Length = 0;
+  Context->BlockUsed = 0;
+}
+
+VOID
+UtilSha256Update (
+  IN OUT UTIL_SHA256_CONTEXT *Context,
+  IN     CONST VOID          *Data,
+  IN     UINTN               Size
+  )
+{
+  CONST UINT8 *Buf = Data;
+  UINTN       Len;
+
+  Context->Length += Size;
+
+  // complete a partial block first
+  if (Context->BlockUsed > 0) {
+    Len = MIN(Size, sizeof(Context->Block) - Context->BlockUsed);
+    CopyMem(Context->Block + Context->BlockUsed, Buf, Len);
+    Context->BlockUsed += Len;
+    Buf += Len;
+    Size -= Len;
+
+    if (Context->BlockUsed < sizeof(Context->Block))
+      return;
+
+    Sha256Transform(Context, Context->Block);
+    Context->BlockUsed = 0;
+  }
+
+  // hash whole blocks directly from the input
+  while (Size >= sizeof(Context->Block)) {
+    Sha256Transform(Context, Buf);
+    Buf += sizeof(Context->Block);
+    Size -= sizeof(Context->Block);
+  }
+
+  CopyMem(Context->Block, Buf, Size);
+  Context->BlockUsed = Size;
+}
+
+VOID
+UtilSha256Final (
+  IN OUT UTIL_SHA256_CONTEXT *Context,
+  OUT    UINT8               *Digest
+  )
+{
+  UINT64 BitLength;
+  UINTN  Index;
+
+  BitLength = LShiftU64(Context->Length, 3);
+
+  // padding
+  Context->Block[Context->BlockUsed++] = 0x80;
+  if (Context->BlockUsed > sizeof(Context->Block) - 8) {
+    ZeroMem(Context->Block + Context->BlockUsed, sizeof(Context->Block) - Context->BlockUsed);
+    Sha256Transform(Context, Context->Block);
+    Context->BlockUsed = 0;
+  }
+  ZeroMem(Context->Block + Context->BlockUsed, sizeof(Context->Block) - 8 - Context->BlockUsed);
+
+  // big endian bit length
+  for (Index = 0; Index < 8; Index++)
+    Context->Block[sizeof(Context->Block) - 1 - Index] = (UINT8)RShiftU64(BitLength, Index * 8);
+  Sha256Transform(Context, Context->Block);
+
+  for (Index = 0; Index < 8; Index++) {
+    Digest[Index * 4]     = (UINT8)(Context->State[Index] >> 24);
+    Digest[Index * 4 + 1] = (UINT8)(Context->State[Index] >> 16);
+    Digest[Index * 4 + 2] = (UINT8)(Context->State[Index] >> 8);
+    Digest[Index * 4 + 3] = (UINT8)(Context->State[Index]);
+  }
+}
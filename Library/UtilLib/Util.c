@@ -9,6 +9,7 @@
 #include <Library/HobLib.h>
 #include <Library/UefiLib.h>
 #include <Library/DevicePathLib.h>
+#include <Library/TimerLib.h>
 
 #include <Protocol/LoadedImage.h>
 
@@ -711,6 +712,25 @@ SettingBoolSet (
   UtilSetEFIDroidVariable(Name, Value?"1":"0");
 }
 
+//
+// files are read in large chunks and split into lines from memory
+//
+#define INI_READER_BUFFER_SIZE SIZE_16KB
+
+typedef struct {
+  EFI_FILE_PROTOCOL *File;
+  CHAR8             *Buffer;
+  // valid bytes in Buffer and the next one to return
+  UINTN             Size;
+  UINTN             Offset;
+  BOOLEAN           Eof;
+
+  ini_handler       Handler;
+  VOID              *User;
+  // set once the handler returned 0
+  BOOLEAN           Stop;
+} INI_EFI_FILE_STREAM;
+
 STATIC
 CHAR8*
 IniReaderEfiFile (
@@ -719,55 +739,87 @@ IniReaderEfiFile (
   VOID *Stream
 )
 {
-    EFI_FILE_PROTOCOL  *File = (EFI_FILE_PROTOCOL*) Stream;
-    EFI_STATUS         Status;
-    UINTN              BufferSize;
-    UINT64             Position;
-    UINTN              Index;
-
-    // stop here if we reached EOF already
-    if (FileHandleEof(File)) {
+    INI_EFI_FILE_STREAM *FileStream = (INI_EFI_FILE_STREAM*) Stream;
+    EFI_STATUS          Status;
+    UINTN               BufferSize;
+    UINTN               Available;
+    UINTN               Length;
+    UINTN               Index;
+    BOOLEAN             Newline;
+
+    // the handler doesn't need any more lines
+    if (FileStream->Stop || Size <= 1) {
         return NULL;
     }
 
-    // get current position
-    Status = FileHandleGetPosition(File, &Position);
-    if (EFI_ERROR(Status))
-      return NULL;
-
-    // read data
-    BufferSize = Size-1;
-    Status = FileHandleRead(File, &BufferSize, String);
-    if (EFI_ERROR(Status)) {
-      return NULL;
+    Length = 0;
+    Newline = FALSE;
+    while (!Newline && Length < (UINTN)Size-1) {
+        // refill buffer
+        if (FileStream->Offset == FileStream->Size) {
+            if (FileStream->Eof)
+                break;
+
+            BufferSize = INI_READER_BUFFER_SIZE;
+            Status = FileHandleRead(FileStream->File, &BufferSize, FileStream->Buffer);
+            if (EFI_ERROR(Status) || BufferSize==0) {
+                FileStream->Eof = TRUE;
+                break;
+            }
+
+            FileStream->Size = BufferSize;
+            FileStream->Offset = 0;
+        }
+
+        // copy up to and including the next newline
+        Available = MIN(FileStream->Size - FileStream->Offset, (UINTN)Size-1 - Length);
+        for(Index=0; Index<Available; Index++) {
+            CHAR8 c = FileStream->Buffer[FileStream->Offset + Index];
+            if(c=='\n' || c=='\r') {
+                Index++;
+                Newline = TRUE;
+                break;
+            }
+        }
+
+        CopyMem(String + Length, FileStream->Buffer + FileStream->Offset, Index);
+        FileStream->Offset += Index;
+        Length += Index;
     }
 
     // EOF or error
-    if (BufferSize==0) {
-      return NULL;
+    if (Length==0) {
+        return NULL;
     }
 
     // terminate buffer
-    String[BufferSize] = '\0';
+    String[Length] = '\0';
 
-    // search for newline
-    for(Index=0; Index<BufferSize; Index++) {
-      CHAR8 c = String[Index];
-      if(c=='\n' || c=='\r') {
-        String[Index+1] = '\0';
+    return String;
+}
 
-        // seek back file position
-        Status = FileHandleSetPosition(File, Position+Index+1);
-        if (EFI_ERROR(Status))
-          return NULL;
+STATIC
+INT32
+IniHandlerEfiFile (
+  VOID        *User,
+  CONST CHAR8 *Section,
+  CONST CHAR8 *Name,
+  CONST CHAR8 *Value
+)
+{
+  INI_EFI_FILE_STREAM *FileStream = (INI_EFI_FILE_STREAM*) User;
+  INT32               Ret;
 
-        break;
-      }
-    }
+  Ret = FileStream->Handler(FileStream->User, Section, Name, Value);
+  if (Ret == 0)
+    FileStream->Stop = TRUE;
 
-    return String;
+  return Ret;
 }
 
+//
+// handlers can return 0 to stop parsing once they found what they need
+//
 INT32
 IniParseEfiFile (
   EFI_FILE_PROTOCOL *File,
@@ -775,7 +827,23 @@ IniParseEfiFile (
   VOID              *User
 )
 {
-  return ini_parse_stream(IniReaderEfiFile, File, Handler, User);
+  INI_EFI_FILE_STREAM FileStream;
+  INT32               Ret;
+
+  SetMem(&FileStream, sizeof(FileStream), 0);
+  FileStream.File = File;
+  FileStream.Handler = Handler;
+  FileStream.User = User;
+
+  FileStream.Buffer = AllocatePool(INI_READER_BUFFER_SIZE);
+  if (FileStream.Buffer == NULL)
+    return -1;
+
+  Ret = ini_parse_stream(IniReaderEfiFile, &FileStream, IniHandlerEfiFile, &FileStream);
+
+  FreePool(FileStream.Buffer);
+
+  return Ret;
 }
 
 
@@ -1078,3 +1146,11 @@ UtilGetSystemMemoryResources (
 
   return EFI_SUCCESS;
 }
+
+UINT64
+UtilGetTimeUs (
+  VOID
+  )
+{
+  return GetTimeInNanoSecond(GetPerformanceCounter()) / 1000ULL;
+}
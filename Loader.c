@@ -154,6 +154,106 @@ PreparePlatformHardware (
   ArmDisableMmu ();
 }
 
+//
+// boot timeline. every phase stores its start time, the record gets
+// persisted right before ExitBootServices so the next run can read it
+//
+STATIC LOADER_BOOT_PROFILE mBootProfile;
+STATIC UINT64 mBootProfileStart;
+STATIC BOOLEAN mBootProfileActive = FALSE;
+
+STATIC CONST CHAR8 *mBootPhaseNames[] = {
+  "identify",
+  "load",
+  "kernel",
+  "ramdisk",
+  "cmdline",
+  "prepare",
+  "variables",
+  "exitbs",
+};
+
+STATIC
+VOID
+BootProfileStart (
+  VOID
+)
+{
+  SetMem(&mBootProfile, sizeof(mBootProfile), 0);
+  mBootProfile.Version = LOADER_BOOT_PROFILE_VERSION;
+  mBootProfileStart = UtilGetTimeUs();
+  mBootProfileActive = TRUE;
+}
+
+STATIC
+VOID
+BootProfileStop (
+  VOID
+)
+{
+  mBootProfileActive = FALSE;
+}
+
+STATIC
+VOID
+BootProfileMark (
+  IN LOADER_BOOT_PHASE      Phase
+)
+{
+  // boots from the menu start after identify
+  if (!mBootProfileActive)
+    BootProfileStart();
+
+  mBootProfile.Start[Phase] = (UINT32)(UtilGetTimeUs() - mBootProfileStart);
+  mBootProfile.Reached |= (1 << Phase);
+}
+
+STATIC
+VOID
+BootProfileSave (
+  VOID
+)
+{
+  EFI_STATUS Status;
+
+  Status = UtilSetEFIDroidDataVariable(L"LastBootProfile", &mBootProfile, sizeof(mBootProfile));
+  if (EFI_ERROR(Status)) {
+    DEBUG((EFI_D_ERROR, "Can't set variable 'LastBootProfile': %r\n", Status));
+  }
+}
+
+EFI_STATUS
+LoaderGetLastBootProfile (
+  OUT LOADER_BOOT_PROFILE   *Profile
+)
+{
+  EFI_STATUS Status;
+  UINTN      Size;
+
+  Size = sizeof(*Profile);
+  Status = gRT->GetVariable (L"LastBootProfile", &gEFIDroidVariableDataGuid, NULL, &Size, Profile);
+  if (Status==EFI_BUFFER_TOO_SMALL)
+    return EFI_INCOMPATIBLE_VERSION;
+  if (EFI_ERROR(Status))
+    return Status;
+
+  if (Size!=sizeof(*Profile) || Profile->Version!=LOADER_BOOT_PROFILE_VERSION)
+    return EFI_INCOMPATIBLE_VERSION;
+
+  return EFI_SUCCESS;
+}
+
+CONST CHAR8*
+LoaderBootPhaseName (
+  IN LOADER_BOOT_PHASE      Phase
+)
+{
+  if (Phase >= LOADER_BOOT_PHASE_MAX)
+    return "unknown";
+
+  return mBootPhaseNames[Phase];
+}
+
 STATIC
 VOID
 BootContext (
@@ -162,6 +262,10 @@ BootContext (
 {
   EFI_STATUS Status;
 
+  // the last thing we can still store
+  BootProfileMark(LOADER_BOOT_PHASE_EXIT_BOOT_SERVICES);
+  BootProfileSave();
+
   // Shut down UEFI boot services. ExitBootServices() will notify every driver that created an event on
   // ExitBootServices event. Example the Interrupt DXE driver will disable the interrupts on this event.
   Status = UtilShutdownUefiBootServices ();
@@ -192,34 +296,689 @@ STATIC VOID DecompError(CHAR8* Str) {
   MenuShowMessage("Decompression Error", Str);
 }
 
+STATIC VOID DecompErrorSilent(CHAR8* Str) {
+  DEBUG((EFI_D_INFO, "decompression: %a\n", Str));
+}
+
+//
+// allocate memory for boot data. UseLibboot selects libboot_alloc instead of
+// AllocatePool. with a BootAddr we try to place the data at its final address
+// first, so libboot_prepare doesn't have to move it again.
+//
+STATIC
+VOID*
+BootDataAlloc (
+  IN BOOLEAN                UseLibboot,
+  IN UINTN                  BootAddr,
+  IN UINTN                  Size
+)
+{
+  VOID *Buffer;
+
+  if (!UseLibboot)
+    return AllocatePool(Size);
+
+  Buffer = NULL;
+  if (BootAddr)
+    Buffer = libboot_platform_reserve(BootAddr, Size);
+  if (Buffer==NULL)
+    Buffer = libboot_alloc(Size);
+
+  return Buffer;
+}
+
+STATIC
+VOID
+BootDataFree (
+  IN BOOLEAN                UseLibboot,
+  IN VOID                   *Buffer
+)
+{
+  if (!UseLibboot) {
+    FreePool(Buffer);
+    return;
+  }
+
+  // reserved pages are gone after this, don't pass them to libboot_free
+  if (libboot_platform_unreserve(Buffer))
+    return;
+
+  libboot_free(Buffer);
+}
+
+//
+// decompress boot data into an allocation of exactly the uncompressed size
+// plus ExtraSize bytes. see BootDataAlloc for UseLibboot and BootAddr.
+// Consumed is the size of the compressed stream, data after it is ignored.
+//
+STATIC
+EFI_STATUS
+DecompressBootData (
+  IN  VOID                  *Data,
+  IN  UINTN                 Size,
+  IN  UINTN                 ExtraSize,
+  IN  BOOLEAN               UseLibboot,
+  IN  UINTN                 BootAddr,
+  OUT VOID                  **Out,
+  OUT UINTN                 *OutSize,
+  OUT UINTN                 *Consumed OPTIONAL
+)
+{
+  CONST CHAR8               *DecompName;
+  decompress_fn             Decompressor;
+  struct decompress_output  Output;
+  unsigned long             SizeHint;
+  unsigned long             Written;
+  long                      Pos;
+  UINT8                     *Buffer;
+
+  Decompressor = decompress_method(Data, Size, &DecompName);
+  if (Decompressor==NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  // use the size stored in the headers if there is one.
+  // it's only a hint, so fall back to the growable output if the data doesn't fit
+  // or a bogus hint is too large to allocate
+  Buffer = NULL;
+  SizeHint = decompress_get_size(Data, Size);
+  if (SizeHint && SizeHint <= MAX_UINTN - ExtraSize) {
+    Buffer = BootDataAlloc(UseLibboot, BootAddr, SizeHint + ExtraSize);
+  }
+
+  if (Buffer) {
+    Pos = 0;
+    if (!decompress_bounded(Decompressor, Data, Size, Buffer, SizeHint, &Written, &Pos, DecompErrorSilent)) {
+      *Out = Buffer;
+      *OutSize = Written;
+      if (Consumed)
+        *Consumed = (Pos > 0 && (UINTN)Pos < Size) ? (UINTN)Pos : Size;
+      return EFI_SUCCESS;
+    }
+
+    DEBUG((EFI_D_INFO, "%a: size hint %lu didn't match, retrying\n", DecompName, (UINT64)SizeHint));
+
+    BootDataFree(UseLibboot, Buffer);
+  }
+
+  // size unknown, collect the output in chunks and copy it once
+  Pos = 0;
+  if (decompress_chunked(Decompressor, Data, Size, &Output, &Pos, DecompError)) {
+    return EFI_LOAD_ERROR;
+  }
+
+  Buffer = BootDataAlloc(UseLibboot, BootAddr, Output.size + ExtraSize);
+  if (Buffer==NULL) {
+    decompress_output_free(&Output);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  decompress_output_copy(&Output, Buffer);
+  *Out = Buffer;
+  *OutSize = Output.size;
+  if (Consumed)
+    *Consumed = (Pos > 0 && (UINTN)Pos < Size) ? (UINTN)Pos : Size;
+  decompress_output_free(&Output);
+
+  return EFI_SUCCESS;
+}
+
+//
+// whether the kernel unpacks another archive after this ramdisk.
+// gzip and plain cpio work everywhere. older kernels fail on data after a
+// legacy lz4 stream, and xz and lzma only allow it on newer ones
+//
+STATIC
+BOOLEAN
+RamdiskAllowsAppending (
+  IN CONST UINT8            *Data,
+  IN UINTN                  Size
+)
+{
+  if (Size < 6)
+    return FALSE;
+
+  if (Data[0]==0x1f && (Data[1]==0x8b || Data[1]==0x9e))
+    return TRUE;
+
+  return !CompareMem(Data, "070701", 6);
+}
+
+//
+// arm64 kernels can't decompress themselves, so Image.gz and friends
+// get decompressed here, directly to the final kernel address if possible
+//
+STATIC
+BOOLEAN
+KernelIsCompressed (
+  IN bootimg_context_t      *context
+)
+{
+  if (context->kernel_size < sizeof(KERNEL64_HDR) || IS_ARM64(context->kernel_data))
+    return FALSE;
+
+  return decompress_method(context->kernel_data, context->kernel_size, NULL) != NULL;
+}
+
+STATIC
+EFI_STATUS
+DecompressKernel (
+  IN bootimg_context_t      *context
+)
+{
+  EFI_STATUS                Status;
+  VOID                      *Kernel;
+  UINTN                     KernelSize;
+  UINTN                     Consumed;
+  UINTN                     AppendedSize;
+  UINT8                     *Combined;
+
+  Status = DecompressBootData(context->kernel_data, context->kernel_size, 0, TRUE, context->kernel_addr, &Kernel, &KernelSize, &Consumed);
+  if (EFI_ERROR(Status))
+    return Status;
+
+  // only arm64 Images need this, arm zImages decompress themselves
+  if (KernelSize < sizeof(KERNEL64_HDR) || !IS_ARM64(Kernel)) {
+    BootDataFree(TRUE, Kernel);
+    return EFI_UNSUPPORTED;
+  }
+
+  // Image.gz-dtb has the DTBs after the compressed stream, they have to follow the Image.
+  // the reservation has the exact Image size, so this loses the in place decompression
+  AppendedSize = context->kernel_size - Consumed;
+  if (AppendedSize) {
+    Combined = libboot_alloc(KernelSize + AppendedSize);
+    if (Combined==NULL) {
+      BootDataFree(TRUE, Kernel);
+      return EFI_OUT_OF_RESOURCES;
+    }
+
+    CopyMem(Combined, Kernel, KernelSize);
+    CopyMem(Combined + KernelSize, (UINT8*)context->kernel_data + Consumed, AppendedSize);
+    BootDataFree(TRUE, Kernel);
+
+    Kernel = Combined;
+    KernelSize += AppendedSize;
+  }
+
+  libboot_free(context->kernel_data);
+  context->kernel_data = Kernel;
+  context->kernel_size = KernelSize;
+
+  return EFI_SUCCESS;
+}
+
+STATIC LOADER_IO_STATS mIoStats;
+
 STATIC boot_intn_t internal_io_fn_blockio_read(boot_io_t* io, void* buf, boot_uintn_t blkoff, boot_uintn_t count) {
     EFI_BLOCK_IO_PROTOCOL* BlockIo = io->pdata;
     EFI_STATUS Status;
 
     Status = BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, blkoff, count*BlockIo->Media->BlockSize, buf);
-    if(EFI_ERROR(Status))
+    if(EFI_ERROR(Status)) {
+        mIoStats.ReadErrors++;
         return -1;
+    }
 
     return count*BlockIo->Media->BlockSize;
 }
 
+//
+// block cache between libboot and the devices.
+// libboot does lots of small reads while identifying and loading images
+//
+#define IO_CACHE_EXTENT_SIZE  SIZE_32KB
+#define IO_CACHE_EXTENTS      4
+
+typedef struct {
+  UINT64                    Offset;
+  UINTN                     Length;
+  UINTN                     LastUsed;
+  BOOLEAN                   Valid;
+} IO_CACHE_EXTENT;
+
+typedef struct {
+  boot_io_t                 Raw;
+  UINT64                    Size;
+  UINT64                    NextOffset;
+  UINTN                     Clock;
+  IO_CACHE_EXTENT           Extents[IO_CACHE_EXTENTS];
+  UINT8                     Data[IO_CACHE_EXTENTS][IO_CACHE_EXTENT_SIZE];
+} IO_CACHE;
+
+STATIC IO_CACHE_EXTENT* IoCacheFind(IO_CACHE* Cache, UINT64 Offset) {
+    UINTN Index;
+
+    for (Index=0; Index<IO_CACHE_EXTENTS; Index++) {
+        IO_CACHE_EXTENT* Extent = &Cache->Extents[Index];
+        if (Extent->Valid && Extent->Offset==Offset) {
+            Extent->LastUsed = ++Cache->Clock;
+            return Extent;
+        }
+    }
+
+    return NULL;
+}
+
+// reads into the caller's buffer, Offset and Length have to be multiples of the block size
+STATIC boot_intn_t IoCacheReadRaw(IO_CACHE* Cache, VOID* Buffer, UINT64 Offset, UINTN Length) {
+    boot_uintn_t blksz = Cache->Raw.blksz;
+
+    mIoStats.RawReads++;
+    mIoStats.RawBytes += Length;
+
+    return Cache->Raw.read(&Cache->Raw, Buffer, DivU64x32(Offset, blksz), Length/blksz);
+}
+
+// replaces the least recently used extent
+STATIC IO_CACHE_EXTENT* IoCacheLoad(IO_CACHE* Cache, UINT64 Offset) {
+    IO_CACHE_EXTENT* Extent = &Cache->Extents[0];
+    UINTN            Index;
+    UINTN            Length;
+    boot_intn_t      rc;
+
+    for (Index=0; Index<IO_CACHE_EXTENTS; Index++) {
+        if (!Cache->Extents[Index].Valid) {
+            Extent = &Cache->Extents[Index];
+            break;
+        }
+        if (Cache->Extents[Index].LastUsed < Extent->LastUsed)
+            Extent = &Cache->Extents[Index];
+    }
+    Index = Extent - Cache->Extents;
+
+    Length = (UINTN)MIN(IO_CACHE_EXTENT_SIZE, Cache->Size - Offset);
+    Extent->Valid = FALSE;
+    rc = IoCacheReadRaw(Cache, Cache->Data[Index], Offset, Length);
+    if (rc < 0)
+        return NULL;
+
+    Extent->Offset = Offset;
+    Extent->Length = rc;
+    Extent->LastUsed = ++Cache->Clock;
+    Extent->Valid = TRUE;
+
+    return Extent;
+}
+
+STATIC boot_intn_t internal_io_fn_cached_read(boot_io_t* io, void* buf, boot_uintn_t blkoff, boot_uintn_t count) {
+    IO_CACHE*        Cache = io->pdata;
+    UINT64           Offset = MultU64x32(blkoff, io->blksz);
+    UINTN            Left = count*io->blksz;
+    UINT8*           Out = buf;
+    BOOLEAN          Sequential = (Offset==Cache->NextOffset);
+    IO_CACHE_EXTENT* Extent;
+    UINT64           Base;
+    UINTN            Skip;
+    UINTN            Length;
+    boot_intn_t      rc;
+
+    while (Left && Offset<Cache->Size) {
+        Base = Offset & ~((UINT64)IO_CACHE_EXTENT_SIZE-1);
+        Skip = (UINTN)(Offset - Base);
+
+        Extent = IoCacheFind(Cache, Base);
+        if (Extent) {
+            mIoStats.Hits++;
+        }
+
+        // large aligned requests skip the cache. adjacent extents are read at once
+        else if (Skip==0 && Left>=IO_CACHE_EXTENT_SIZE) {
+            Length = IO_CACHE_EXTENT_SIZE;
+            while (Length+IO_CACHE_EXTENT_SIZE<=Left && !IoCacheFind(Cache, Base+Length))
+                Length += IO_CACHE_EXTENT_SIZE;
+
+            mIoStats.Misses++;
+            rc = IoCacheReadRaw(Cache, Out, Base, Length);
+            if (rc < 0)
+                return -1;
+
+            Out += rc;
+            Offset += rc;
+            Left -= rc;
+            if ((UINTN)rc < Length)
+                break;
+            continue;
+        }
+
+        else {
+            mIoStats.Misses++;
+            Extent = IoCacheLoad(Cache, Base);
+            if (!Extent)
+                return -1;
+
+            // sequential access, fetch the next extent too
+            Base += IO_CACHE_EXTENT_SIZE;
+            if (Sequential && Base<Cache->Size && !IoCacheFind(Cache, Base)) {
+                mIoStats.ReadAheads++;
+                IoCacheLoad(Cache, Base);
+            }
+        }
+
+        if (Skip >= Extent->Length)
+            break;
+
+        Length = MIN(Left, Extent->Length - Skip);
+        CopyMem(Out, Cache->Data[Extent - Cache->Extents] + Skip, Length);
+        Out += Length;
+        Offset += Length;
+        Left -= Length;
+    }
+
+    Cache->NextOffset = Offset;
+
+    return Out - (UINT8*)buf;
+}
+
+// wraps a device in the block cache. falls back to uncached access if that's not possible
+STATIC boot_io_t* IoCacheCreate(boot_io_t* Raw) {
+    boot_io_t* io;
+    IO_CACHE*  Cache;
+
+    io = libboot_alloc(sizeof(boot_io_t));
+    if(!io) return NULL;
+    CopyMem(io, Raw, sizeof(*io));
+
+    if (Raw->blksz==0 || IO_CACHE_EXTENT_SIZE % Raw->blksz)
+        return io;
+
+    Cache = libboot_alloc(sizeof(*Cache));
+    if(!Cache)
+        return io;
+    SetMem(Cache, sizeof(*Cache), 0);
+    CopyMem(&Cache->Raw, Raw, sizeof(*Raw));
+    Cache->Size = MultU64x32(Raw->numblocks, Raw->blksz);
+
+    io->read = internal_io_fn_cached_read;
+    io->pdata = Cache;
+    io->pdata_is_allocated = 1;
+
+    return io;
+}
+
+STATIC VOID IoCacheFree(boot_io_t* io) {
+    if (io->pdata_is_allocated)
+        libboot_free(io->pdata);
+    libboot_free(io);
+}
+
+//
+// header prefetch. the first extent of every device gets requested at once,
+// through BlockIo2 where possible, so identifying them doesn't have to wait
+// for one read after another
+//
+typedef struct {
+  EFI_BLOCK_IO_PROTOCOL     *BlockIo;
+  EFI_BLOCK_IO2_PROTOCOL    *BlockIo2;
+  EFI_BLOCK_IO2_TOKEN       Token;
+  BOOLEAN                   Pending;
+  EFI_STATUS                Status;
+  UINTN                     Length;
+  VOID                      *Buffer;
+} IO_PREFETCH;
+
+STATIC IO_PREFETCH *mIoPrefetch = NULL;
+STATIC UINTN       mIoPrefetchCount = 0;
+
+STATIC VOID IoPrefetchComplete(IO_PREFETCH* Prefetch) {
+    UINTN Index;
+
+    if (!Prefetch->Pending)
+        return;
+
+    gBS->WaitForEvent(1, &Prefetch->Token.Event, &Index);
+    Prefetch->Status = Prefetch->Token.TransactionStatus;
+    gBS->CloseEvent(Prefetch->Token.Event);
+    Prefetch->Pending = FALSE;
+}
+
+STATIC VOID IoPrefetchRelease(IO_PREFETCH* Prefetch) {
+    IoPrefetchComplete(Prefetch);
+
+    if (Prefetch->Buffer) {
+        FreePages(Prefetch->Buffer, EFI_SIZE_TO_PAGES(IO_CACHE_EXTENT_SIZE));
+        Prefetch->Buffer = NULL;
+    }
+    Prefetch->Status = EFI_NOT_READY;
+}
+
+// hands the prefetched header of BlockIo to its cache
+STATIC VOID IoPrefetchConsume(EFI_BLOCK_IO_PROTOCOL* BlockIo, IO_CACHE* Cache) {
+    IO_PREFETCH* Prefetch;
+    UINTN        Index;
+
+    for (Index=0; Index<mIoPrefetchCount; Index++) {
+        Prefetch = &mIoPrefetch[Index];
+        if (Prefetch->BlockIo!=BlockIo || Prefetch->Buffer==NULL)
+            continue;
+
+        IoPrefetchComplete(Prefetch);
+        if (!EFI_ERROR(Prefetch->Status)) {
+            CopyMem(Cache->Data[0], Prefetch->Buffer, Prefetch->Length);
+            Cache->Extents[0].Offset = 0;
+            Cache->Extents[0].Length = Prefetch->Length;
+            Cache->Extents[0].LastUsed = ++Cache->Clock;
+            Cache->Extents[0].Valid = TRUE;
+        }
+
+        IoPrefetchRelease(Prefetch);
+        return;
+    }
+}
+
+EFI_STATUS
+LoaderPrefetchBlockIoHeaders (
+  IN LOADER_PREFETCH_FILTER  Filter
+)
+{
+  EFI_STATUS             Status;
+  UINTN                  HandleCount;
+  EFI_HANDLE             *HandleBuffer;
+  UINTN                  Index;
+  IO_PREFETCH            *Prefetch;
+  EFI_BLOCK_IO_PROTOCOL  *BlockIo;
+
+  LoaderFreePrefetchedHeaders();
+
+  Status = gBS->LocateHandleBuffer (ByProtocol, &gEfiBlockIoProtocolGuid, NULL, &HandleCount, &HandleBuffer);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+
+  mIoPrefetch = AllocateZeroPool(HandleCount * sizeof(*mIoPrefetch));
+  if (mIoPrefetch==NULL) {
+    FreePool(HandleBuffer);
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  // issue all asynchronous reads first
+  for (Index = 0; Index < HandleCount; Index++) {
+    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiBlockIoProtocolGuid, (VOID **)&BlockIo);
+    if (EFI_ERROR (Status))
+      continue;
+
+    if (Filter && !Filter(HandleBuffer[Index], BlockIo))
+      continue;
+
+    // same requirements as the block cache
+    if (!BlockIo->Media->MediaPresent || BlockIo->Media->BlockSize==0 || IO_CACHE_EXTENT_SIZE % BlockIo->Media->BlockSize)
+      continue;
+
+    Prefetch = &mIoPrefetch[mIoPrefetchCount];
+    Prefetch->BlockIo = BlockIo;
+    Prefetch->Status = EFI_NOT_READY;
+    Prefetch->Length = (UINTN)MIN(IO_CACHE_EXTENT_SIZE, MultU64x32(BlockIo->Media->LastBlock+1, BlockIo->Media->BlockSize));
+
+    // pages satisfy the IoAlign of all devices we care about
+    Prefetch->Buffer = AllocatePages(EFI_SIZE_TO_PAGES(IO_CACHE_EXTENT_SIZE));
+    if (Prefetch->Buffer==NULL)
+      break;
+    mIoPrefetchCount++;
+
+    Status = gBS->HandleProtocol (HandleBuffer[Index], &gEfiBlockIo2ProtocolGuid, (VOID **)&Prefetch->BlockIo2);
+    if (EFI_ERROR (Status)) {
+      Prefetch->BlockIo2 = NULL;
+      continue;
+    }
+
+    Status = gBS->CreateEvent (0, TPL_CALLBACK, NULL, NULL, &Prefetch->Token.Event);
+    if (EFI_ERROR (Status))
+      continue;
+
+    Status = Prefetch->BlockIo2->ReadBlocksEx (Prefetch->BlockIo2, Prefetch->BlockIo2->Media->MediaId, 0, &Prefetch->Token, Prefetch->Length, Prefetch->Buffer);
+    if (EFI_ERROR (Status)) {
+      gBS->CloseEvent(Prefetch->Token.Event);
+      continue;
+    }
+
+    mIoStats.RawReads++;
+    mIoStats.RawBytes += Prefetch->Length;
+    Prefetch->Pending = TRUE;
+  }
+
+  // devices without BlockIo2 get read in one go while the others are in flight
+  for (Index = 0; Index < mIoPrefetchCount; Index++) {
+    Prefetch = &mIoPrefetch[Index];
+    if (Prefetch->Pending)
+      continue;
+
+    BlockIo = Prefetch->BlockIo;
+    Prefetch->Status = BlockIo->ReadBlocks (BlockIo, BlockIo->Media->MediaId, 0, Prefetch->Length, Prefetch->Buffer);
+    mIoStats.RawReads++;
+    mIoStats.RawBytes += Prefetch->Length;
+  }
+
+  FreePool(HandleBuffer);
+
+  return EFI_SUCCESS;
+}
+
+//
+// crc32 over the first 4KB of a device, from the prefetched header if there is one.
+// meant for detecting changed contents, not for verifying them
+//
+EFI_STATUS
+LoaderGetBlockIoHeaderCrc (
+  IN  EFI_BLOCK_IO_PROTOCOL *BlockIo,
+  OUT UINT32                *Crc
+)
+{
+  EFI_STATUS   Status;
+  IO_PREFETCH  *Prefetch;
+  UINTN        Index;
+  UINTN        Length;
+  VOID         *Buffer;
+
+  Length = (UINTN)MIN(MAX(SIZE_4KB, BlockIo->Media->BlockSize), MultU64x32(BlockIo->Media->LastBlock+1, BlockIo->Media->BlockSize));
+
+  for (Index=0; Index<mIoPrefetchCount; Index++) {
+    Prefetch = &mIoPrefetch[Index];
+    if (Prefetch->BlockIo!=BlockIo || Prefetch->Buffer==NULL)
+      continue;
+
+    IoPrefetchComplete(Prefetch);
+    if (EFI_ERROR(Prefetch->Status))
+      return Prefetch->Status;
+
+    return gBS->CalculateCrc32(Prefetch->Buffer, MIN(Length, Prefetch->Length), Crc);
+  }
+
+  Buffer = AllocatePages(EFI_SIZE_TO_PAGES(Length));
+  if (Buffer==NULL)
+    return EFI_OUT_OF_RESOURCES;
+
+  Status = BlockIo->ReadBlocks (BlockIo, BlockIo->Media->MediaId, 0, Length, Buffer);
+  mIoStats.RawReads++;
+  mIoStats.RawBytes += Length;
+  if (!EFI_ERROR(Status))
+    Status = gBS->CalculateCrc32(Buffer, Length, Crc);
+
+  FreePages(Buffer, EFI_SIZE_TO_PAGES(Length));
+
+  return Status;
+}
+
+VOID
+LoaderFreePrefetchedHeaders (
+  VOID
+)
+{
+  UINTN Index;
+
+  // the buffers can't go away before pending reads are done
+  for (Index = 0; Index < mIoPrefetchCount; Index++)
+    IoPrefetchRelease(&mIoPrefetch[Index]);
+
+  if (mIoPrefetch)
+    FreePool(mIoPrefetch);
+  mIoPrefetch = NULL;
+  mIoPrefetchCount = 0;
+}
+
+VOID
+LoaderGetIoStats (
+  OUT LOADER_IO_STATS *Stats
+)
+{
+  CopyMem(Stats, &mIoStats, sizeof(*Stats));
+}
+
+VOID
+LoaderResetIoStats (
+  VOID
+)
+{
+  SetMem(&mIoStats, sizeof(mIoStats), 0);
+}
+
 INTN libboot_identify_blockio(EFI_BLOCK_IO_PROTOCOL* BlockIo, bootimg_context_t* context) {
-    boot_io_t* io = libboot_alloc(sizeof(boot_io_t));
+    boot_io_t raw;
+    SetMem(&raw, sizeof(raw), 0);
+    raw.read = internal_io_fn_blockio_read;
+    raw.blksz = BlockIo->Media->BlockSize;
+    raw.numblocks = BlockIo->Media->LastBlock+1;
+    raw.pdata = BlockIo;
+    raw.pdata_is_allocated = 0;
+
+    boot_io_t* io = IoCacheCreate(&raw);
     if(!io) return -1;
-    io->read = internal_io_fn_blockio_read;
-    io->blksz = BlockIo->Media->BlockSize;
-    io->numblocks = BlockIo->Media->LastBlock+1;
-    io->pdata = BlockIo;
-    io->pdata_is_allocated = 0;
+
+    // use the header if it was prefetched
+    if (io->pdata_is_allocated)
+        IoPrefetchConsume(BlockIo, io->pdata);
 
     INTN rc = libboot_identify(io, context);
     if(rc) {
-        libboot_free(io);
+        IoCacheFree(io);
     }
 
     return rc;
 }
 
+//
+// like libboot_identify_blockio, but tells a device without a boot image (EFI_UNSUPPORTED)
+// apart from one which couldn't be identified because reads or allocations failed
+//
+EFI_STATUS
+LoaderIdentifyBlockIo (
+  IN EFI_BLOCK_IO_PROTOCOL *BlockIo,
+  IN bootimg_context_t     *context
+)
+{
+  UINT64       ReadErrors = mIoStats.ReadErrors;
+  boot_uintn_t AllocFailures = libboot_platform_alloc_failures();
+
+  if (!libboot_identify_blockio(BlockIo, context))
+    return EFI_SUCCESS;
+
+  if (mIoStats.ReadErrors != ReadErrors)
+    return EFI_DEVICE_ERROR;
+  if (libboot_platform_alloc_failures() != AllocFailures)
+    return EFI_OUT_OF_RESOURCES;
+
+  return EFI_UNSUPPORTED;
+}
+
 STATIC boot_intn_t internal_io_fn_file_read(boot_io_t* io, void* buf, boot_uintn_t blkoff, boot_uintn_t count) {
     EFI_FILE_PROTOCOL  *File = io->pdata;
     EFI_STATUS         Status;
@@ -247,17 +1006,20 @@ INTN libboot_identify_file(EFI_FILE_PROTOCOL* File, bootimg_context_t* context)
       return -1;
     }
 
-    boot_io_t* io = libboot_alloc(sizeof(boot_io_t));
+    boot_io_t raw;
+    SetMem(&raw, sizeof(raw), 0);
+    raw.read = internal_io_fn_file_read;
+    raw.blksz = 1;
+    raw.numblocks = FileSize*raw.blksz;
+    raw.pdata = File;
+    raw.pdata_is_allocated = 0;
+
+    boot_io_t* io = IoCacheCreate(&raw);
     if(!io) return -1;
-    io->read = internal_io_fn_file_read;
-    io->blksz = 1;
-    io->numblocks = FileSize*io->blksz;
-    io->pdata = File;
-    io->pdata_is_allocated = 0;
 
     INTN rc = libboot_identify(io, context);
     if(rc) {
-        libboot_free(io);
+        IoCacheFree(io);
     }
 
     return rc;
@@ -481,12 +1243,78 @@ ERROR_FREE_RAMDISK:
   return Status;
 }
 
+STATIC CONST CHAR8 *mCpioNameMbInit = "/multiboot_init";
+STATIC CONST CHAR8 *mCpioNameMbFstab = "/multiboot_fstab";
+STATIC CONST CHAR8 *mCpioNameMbCmdline = "/multiboot_cmdline";
+
+//
+// size of the objects created by CpioAddMultibootFiles, including the trailer
+//
+STATIC
+UINTN
+CpioMultibootFilesSize (
+  IN UINTN                  MultibootSize,
+  IN UINTN                  FstabSize,
+  IN UINTN                  CmdlineSize
+)
+{
+  UINTN Size = 0;
+
+  Size += CpioPredictObjSize(AsciiStrSize(mCpioNameMbInit), MultibootSize);
+  Size += CpioPredictObjSize(AsciiStrSize(mCpioNameMbFstab), FstabSize);
+  Size += CpioPredictObjSize(AsciiStrSize(mCpioNameMbCmdline), CmdlineSize);
+  Size += CpioPredictObjSize(AsciiStrSize(CPIO_TRAILER), 0);
+
+  return Size;
+}
+
+STATIC
+EFI_STATUS
+CpioAddMultibootFiles (
+  IN  CPIO_NEWC_HEADER      *cpiohd,
+  IN  VOID                  *MultibootBin,
+  IN  UINTN                 MultibootSize,
+  IN  VOID                  *FstabBin,
+  IN  UINTN                 FstabSize,
+  IN  libboot_list_node_t   *Cmdline,
+  IN  UINTN                 CmdlineSize,
+  OUT CPIO_NEWC_HEADER      **End
+)
+{
+  EFI_STATUS                Status;
+  CPIO_NEWC_HEADER          *cpiohd_mbcmdline;
+  VOID                      *cpio_mbcmdline_data;
+
+  // multiboot_init
+  cpiohd = CpioCreateObj (cpiohd, mCpioNameMbInit, MultibootBin, MultibootSize, CPIO_MODE_REG|0700);
+
+  // multiboot fstab
+  cpiohd = CpioCreateObj (cpiohd, mCpioNameMbFstab, FstabBin, FstabSize, CPIO_MODE_REG|0400);
+
+  // multiboot_cmdline
+  cpiohd_mbcmdline = cpiohd;
+  cpiohd = CpioCreateObj (cpiohd, mCpioNameMbCmdline, NULL, CmdlineSize, CPIO_MODE_REG|0444);
+
+  // write cmdline data
+  Status = CpioGetData(cpiohd_mbcmdline, &cpio_mbcmdline_data, NULL);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  libboot_cmdline_generate(Cmdline, cpio_mbcmdline_data, CmdlineSize);
+
+  // cpio trailer
+  *End = CpioCreateObj (cpiohd, CPIO_TRAILER, NULL, 0, 0);
+
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS
 LoaderBootContext (
   IN bootimg_context_t      *context,
   IN multiboot_handle_t     *mbhandle,
   IN BOOLEAN                DisablePatching,
   IN BOOLEAN                IsRecovery,
+  IN LOADER_RAMDISK_TYPE    RamdiskType,
   IN LAST_BOOT_ENTRY        *LastBootEntry
 )
 {
@@ -494,18 +1322,24 @@ LoaderBootContext (
   EFI_STATUS                Status2;
   EFI_STATUS                ReturnStatus = EFI_UNSUPPORTED;
   VOID                      *NewRamdisk = NULL;
-  UINT32                    RamdiskUncompressedLen = 0;
+  UINTN                     RamdiskUncompressedLen = 0;
+  UINTN                     RamdiskExtraLen = 0;
+  UINTN                     RamdiskOffset;
   CHAR8                     Buf[100];
   INTN                      rc;
   UINT32                    i;
   CHAR8                     **error_stack;
   libboot_list_node_t       mbcmdline;
   BOOLEAN                   Is64BitKernel;
+  BOOLEAN                   KernelCompressed;
   CONST CHAR8               *MultibootInitUefiRdPath;
+  LAST_BOOT_ENTRY           BootedEntry;
+  LAST_BOOT_ENTRY           *SavedEntry = NULL;
 
   libboot_list_initialize(&mbcmdline);
 
   // load image
+  BootProfileMark(LOADER_BOOT_PHASE_LOAD);
   rc = libboot_load(context);
 
   // libboot returns an error because it can't handle efi files
@@ -520,7 +1354,9 @@ LoaderBootContext (
   // libboot returned an error, and this is not a EFI image
   if(rc) goto CLEANUP;
 
-  Is64BitKernel = IS_ARM64(context->kernel_data);
+  // compressed kernels are always arm64 Images, which we check after decompressing them
+  KernelCompressed = KernelIsCompressed(context);
+  Is64BitKernel = KernelCompressed || IS_ARM64(context->kernel_data);
   if (Is64BitKernel) {
     MultibootInitUefiRdPath = "arm64/multiboot_init";
   }
@@ -532,18 +1368,23 @@ LoaderBootContext (
   if(mLKApi)
     mLKApi->boot_update_addrs(Is64BitKernel, &context->kernel_addr, &context->ramdisk_addr, &context->tags_addr);
 
-  if(context->ramdisk_data) {
-    // get decompressor
-    CONST CHAR8 *DecompName;
-    decompress_fn Decompressor = decompress_method(context->ramdisk_data, context->ramdisk_size, &DecompName);
-    if(Decompressor==NULL) {
-      MenuShowMessage("Error", "Can't find decompressor.");
+  // decompress kernel
+  if (KernelCompressed) {
+    BootProfileMark(LOADER_BOOT_PHASE_KERNEL);
+    Status = DecompressKernel(context);
+    if (Status==EFI_UNSUPPORTED) {
+      MenuShowMessage("Error", "Compressed kernel is not an arm64 Image.");
       goto CLEANUP;
     }
+    else if (EFI_ERROR(Status)) {
+      AsciiSPrint(Buf, sizeof(Buf), "Can't decompress kernel: %r", Status);
+      MenuShowMessage("Error", Buf);
+      goto CLEANUP;
+    }
+  }
 
-    // get uncompressed size
-    // since the Linux decompressor doesn't support predicting the length we hardcode this to 10MB
-    RamdiskUncompressedLen = 50*1024*1024;
+  if(context->ramdisk_data) {
+    BootProfileMark(LOADER_BOOT_PHASE_RAMDISK);
 
     // get multiboot_init from UEFIRamdisk
     UINT8 *MultibootBin;
@@ -571,39 +1412,72 @@ LoaderBootContext (
       goto CLEANUP;
     }
 
-    // add multiboot binary size to uncompressed ramdisk size
-    CONST CHAR8 *cpio_name_mbinit = "/multiboot_init";
-    RamdiskUncompressedLen += CpioPredictObjSize(AsciiStrLen(cpio_name_mbinit), MultibootSize);
-
-    // add fstab file size to uncompressed ramdisk size
-    CONST CHAR8 *cpio_name_mbfstab = "/multiboot_fstab";
-    RamdiskUncompressedLen += CpioPredictObjSize(AsciiStrLen(cpio_name_mbfstab), FstabSize);
-
-    // add cmdline file size to uncompressed ramdisk size
-    CONST CHAR8 *cpio_name_mbcmdline = "/multiboot_cmdline";
+    // reserve space for the multiboot files
     UINTN mbcmdline_len = libboot_cmdline_length(&mbcmdline);
-    RamdiskUncompressedLen += CpioPredictObjSize(AsciiStrLen(cpio_name_mbcmdline), mbcmdline_len);
+    RamdiskExtraLen = CpioMultibootFilesSize(MultibootSize, FstabSize, mbcmdline_len);
+
+    // the kernel unpacks concatenated archives, so unless we have to pick
+    // one half of a dual ramdisk we keep the compressed ramdisk as it is
+    // and append an uncompressed cpio with the multiboot files
+    if (RamdiskType==LOADER_RAMDISK_SINGLE && DisablePatching)
+      goto RAMDISK_DONE;
+
+    if (RamdiskType==LOADER_RAMDISK_SINGLE && RamdiskAllowsAppending(context->ramdisk_data, context->ramdisk_size)) {
+      // the appended archive has to start 4 byte aligned
+      RamdiskOffset = ALIGN_VALUE(context->ramdisk_size, 4);
+      NewRamdisk = BootDataAlloc(TRUE, context->ramdisk_addr, RamdiskOffset + RamdiskExtraLen);
+      if (!NewRamdisk) {
+        AsciiSPrint(Buf, sizeof(Buf), "Can't allocate memory for ramdisk: %r", EFI_OUT_OF_RESOURCES);
+        MenuShowMessage("Error", Buf);
+        goto CLEANUP;
+      }
+      CopyMem(NewRamdisk, context->ramdisk_data, context->ramdisk_size);
+      SetMem((UINT8*)NewRamdisk + context->ramdisk_size, RamdiskOffset - context->ramdisk_size, 0);
 
-    // allocate uncompressed ramdisk memory
-    NewRamdisk = libboot_alloc(RamdiskUncompressedLen);
-    if (!NewRamdisk) {
+      CPIO_NEWC_HEADER *cpioappend;
+      Status = CpioAddMultibootFiles((CPIO_NEWC_HEADER*)((UINT8*)NewRamdisk + RamdiskOffset), MultibootBin, MultibootSize,
+                                     FstabBin, FstabSize, &mbcmdline, mbcmdline_len, &cpioappend);
+      if (EFI_ERROR(Status)) {
+        AsciiSPrint(Buf, sizeof(Buf), "Can't load cmdline: %r", Status);
+        MenuShowMessage("Error", Buf);
+        goto CLEANUP;
+      }
+      ASSERT((UINTN)cpioappend == (UINTN)NewRamdisk + RamdiskOffset + RamdiskExtraLen);
+
+      // replace ramdisk data
+      libboot_free(context->ramdisk_data);
+      context->ramdisk_data = NewRamdisk;
+      context->ramdisk_size = RamdiskOffset + RamdiskExtraLen;
+      NewRamdisk = NULL;
+      goto RAMDISK_DONE;
+    }
+
+    // decompress ramdisk
+    Status = DecompressBootData(context->ramdisk_data, context->ramdisk_size, RamdiskExtraLen, TRUE, context->ramdisk_addr, &NewRamdisk, &RamdiskUncompressedLen, NULL);
+    if (Status==EFI_UNSUPPORTED) {
+      MenuShowMessage("Error", "Can't find decompressor.");
+      goto CLEANUP;
+    }
+    else if (Status==EFI_OUT_OF_RESOURCES) {
       AsciiSPrint(Buf, sizeof(Buf), "Can't allocate memory for decompressing ramdisk: %r", Status);
       MenuShowMessage("Error", Buf);
       goto CLEANUP;
     }
-
-    // decompress ramdisk
-    if(Decompressor(context->ramdisk_data, context->ramdisk_size, NULL, NULL, NewRamdisk, NULL, DecompError)) {
+    else if (EFI_ERROR(Status)) {
       goto CLEANUP;
     }
+    UINTN RamdiskBufferEnd = ((UINTN)NewRamdisk) + RamdiskUncompressedLen + RamdiskExtraLen;
 
     // get CPIO ramdisk
     CPIO_NEWC_HEADER *cpiohd = (CPIO_NEWC_HEADER *) NewRamdisk;
 
     // check if this is a merged ramdisk
-    CPIO_NEWC_HEADER* DualRamdiskAndroidHdr = CpioGetByName(cpiohd, "sbin/ramdisk.cpio");
-    CPIO_NEWC_HEADER* DualRamdiskRecoveryHdr = CpioGetByName(cpiohd, "sbin/ramdisk-recovery.cpio");
-    if (DualRamdiskAndroidHdr && DualRamdiskRecoveryHdr) {
+    CONST CHAR8 *DualRamdiskNames[] = { "sbin/ramdisk.cpio", "sbin/ramdisk-recovery.cpio" };
+    CPIO_NEWC_HEADER* DualRamdiskHdrs[2];
+    if (CpioFindAll(cpiohd, DualRamdiskNames, 2, DualRamdiskHdrs)==2) {
+      CPIO_NEWC_HEADER* DualRamdiskAndroidHdr = DualRamdiskHdrs[0];
+      CPIO_NEWC_HEADER* DualRamdiskRecoveryHdr = DualRamdiskHdrs[1];
+
       // get android ramdisk
       CPIO_NEWC_HEADER* DualRamdiskAndroid;
       UINTN DualRamdiskAndroidSize;
@@ -629,32 +1503,16 @@ LoaderBootContext (
 
     // add multiboot files
     if(!DisablePatching) {
-      // multiboot_init
-      cpiohd = CpioCreateObj (cpiohd, cpio_name_mbinit, MultibootBin, MultibootSize, CPIO_MODE_REG|0700);
-
-      // multiboot fstab
-      cpiohd = CpioCreateObj (cpiohd, cpio_name_mbfstab, FstabBin, FstabSize, CPIO_MODE_REG|0400);
-
-      // multiboot_cmdline
-      CPIO_NEWC_HEADER *cpiohd_mbcmdline = cpiohd;
-      cpiohd = CpioCreateObj (cpiohd, cpio_name_mbcmdline, NULL, mbcmdline_len, CPIO_MODE_REG|0444);
-
-      // write cmdline data
-      VOID *cpio_mbcmdline_data;
-      Status = CpioGetData(cpiohd_mbcmdline, &cpio_mbcmdline_data, NULL);
+      Status = CpioAddMultibootFiles(cpiohd, MultibootBin, MultibootSize, FstabBin, FstabSize, &mbcmdline, mbcmdline_len, &cpiohd);
       if (EFI_ERROR(Status)) {
         AsciiSPrint(Buf, sizeof(Buf), "Can't load cmdline: %r", Status);
         MenuShowMessage("Error", Buf);
         goto CLEANUP;
       }
-      libboot_cmdline_generate(&mbcmdline, cpio_mbcmdline_data, mbcmdline_len);
-
-      // cpio trailer
-      cpiohd = CpioCreateObj (cpiohd, CPIO_TRAILER, NULL, 0, 0);
     }
 
     // verify that we didn't overflow the buffer
-    ASSERT((UINT32)cpiohd <= ((UINT32)NewRamdisk)+RamdiskUncompressedLen);
+    ASSERT((UINTN)cpiohd <= RamdiskBufferEnd);
 
     // check if this is a recovery ramdisk
     if (CpioGetByName((CPIO_NEWC_HEADER *)NewRamdisk, "sbin/recovery")) {
@@ -668,7 +1526,10 @@ LoaderBootContext (
     NewRamdisk = NULL;
   }
 
+RAMDISK_DONE:
+
   // patch cmdline
+  BootProfileMark(LOADER_BOOT_PHASE_CMDLINE);
   Status = PatchCmdline(context, mbhandle, IsRecovery, DisablePatching);
   if (EFI_ERROR(Status)) {
     AsciiSPrint(Buf, sizeof(Buf), "Can't load cmdline: %r", Status);
@@ -677,11 +1538,22 @@ LoaderBootContext (
   }
 
   // prepare for boot
+  BootProfileMark(LOADER_BOOT_PHASE_PREPARE);
   rc = libboot_prepare(context);
   if(rc) goto CLEANUP;
 
-  // set LastBootEntry variable
-  Status = UtilSetEFIDroidDataVariable(L"LastBootEntry", LastBootEntry, LastBootEntry?sizeof(*LastBootEntry):0);
+  // set LastBootEntry variable, with the flags needed to boot it the same way again
+  BootProfileMark(LOADER_BOOT_PHASE_VARIABLES);
+  if (LastBootEntry) {
+    BootedEntry = *LastBootEntry;
+    BootedEntry.Flags = (LastBootEntry->Flags & LAST_BOOT_FLAG_INDIRECT) | LAST_BOOT_FLAG_VALID;
+    if (DisablePatching)
+      BootedEntry.Flags |= LAST_BOOT_FLAG_DISABLE_PATCHING;
+    if (IsRecovery)
+      BootedEntry.Flags |= LAST_BOOT_FLAG_RECOVERY;
+    SavedEntry = &BootedEntry;
+  }
+  Status = UtilSetEFIDroidDataVariable(L"LastBootEntry", SavedEntry, SavedEntry?sizeof(*SavedEntry):0);
   if (EFI_ERROR (Status)) {
     if (!(LastBootEntry==NULL && Status==EFI_NOT_FOUND)) {
       AsciiSPrint(Buf, sizeof(Buf), "Can't set variable 'LastBootEntry': %r", Status);
@@ -708,6 +1580,10 @@ CLEANUP:
   // unload
   libboot_unload(context);
 
+  // we didn't boot, so give back the memory we reserved at the boot addresses
+  libboot_platform_release_reserved();
+  BootProfileStop();
+
   return ReturnStatus;
 }
 
@@ -718,8 +1594,7 @@ LoaderGetDecompressedRamdisk (
 )
 {
   EFI_STATUS                Status;
-  CONST CHAR8               *DecompName;
-  UINT32                    RamdiskUncompressedLen = 0;
+  UINTN                     RamdiskUncompressedLen = 0;
   CPIO_NEWC_HEADER          *DecompressedRamdisk = NULL;
 
   Status = EFI_LOAD_ERROR;
@@ -731,19 +1606,9 @@ LoaderGetDecompressedRamdisk (
   // check if we have a ramdisk
   if(!context->ramdisk_data) goto ERROR;
 
-  // get decompressor
-  decompress_fn Decompressor = decompress_method(context->ramdisk_data, context->ramdisk_size, &DecompName);
-  if(Decompressor==NULL) goto ERROR;
-
-  // get uncompressed size
-  // since the Linux decompressor doesn't support predicting the length we hardcode this to 10MB
-  RamdiskUncompressedLen = 50*1024*1024;
-  DecompressedRamdisk = AllocatePool(RamdiskUncompressedLen);
-  if(DecompressedRamdisk==NULL) goto ERROR;
-
   // decompress ramdisk
-  if(Decompressor(context->ramdisk_data, context->ramdisk_size, NULL, NULL, (VOID*)DecompressedRamdisk, NULL, DecompError))
-    goto ERROR;
+  Status = DecompressBootData(context->ramdisk_data, context->ramdisk_size, 0, FALSE, 0, (VOID**)&DecompressedRamdisk, &RamdiskUncompressedLen, NULL);
+  if(EFI_ERROR(Status)) goto ERROR;
 
   // return data
   *DecompressedRamdiskOut = DecompressedRamdisk;
@@ -761,6 +1626,74 @@ CLEANUP:
   return Status;
 }
 
+STATIC CPIO_WALKER *mRamdiskWalker = NULL;
+STATIC EFI_STATUS  mRamdiskWalkStatus;
+
+STATIC long RamdiskWalkFlush(void *Data, unsigned long Size) {
+  mRamdiskWalkStatus = CpioWalkFeed(mRamdiskWalker, Data, Size);
+
+  // makes the decompressor stop
+  if (mRamdiskWalkStatus != EFI_SUCCESS)
+    return -1;
+
+  return Size;
+}
+
+EFI_STATUS
+LoaderWalkRamdisk (
+  IN bootimg_context_t      *context,
+  IN CPIO_WALKER            *Walker
+)
+{
+  EFI_STATUS                Status;
+  CONST CHAR8               *DecompName;
+  decompress_fn             Decompressor;
+  INTN                      rc;
+
+  Status = EFI_LOAD_ERROR;
+
+  // load image
+  rc = libboot_load_partial(context, LIBBOOT_LOAD_TYPE_RAMDISK, 0);
+  if(rc) goto CLEANUP;
+
+  // check if we have a ramdisk
+  if(!context->ramdisk_data) goto CLEANUP;
+
+  Decompressor = decompress_method(context->ramdisk_data, context->ramdisk_size, &DecompName);
+  if(Decompressor==NULL) {
+    // uncompressed archive
+    if (!CpioIsValid(context->ramdisk_data)) {
+      Status = EFI_UNSUPPORTED;
+      goto CLEANUP;
+    }
+
+    Status = CpioWalkFeed(Walker, context->ramdisk_data, context->ramdisk_size);
+  }
+  else {
+    // the walker decides how much of the ramdisk we have to decompress
+    mRamdiskWalker = Walker;
+    mRamdiskWalkStatus = EFI_SUCCESS;
+    rc = Decompressor(context->ramdisk_data, context->ramdisk_size, NULL, RamdiskWalkFlush, NULL, NULL, DecompErrorSilent);
+    mRamdiskWalker = NULL;
+
+    if (mRamdiskWalkStatus!=EFI_SUCCESS)
+      Status = mRamdiskWalkStatus;
+    else if (rc)
+      Status = EFI_LOAD_ERROR;
+    else
+      Status = EFI_SUCCESS;
+  }
+
+  // the walk has to end with the trailer or a callback stopping it
+  if (Status==EFI_SUCCESS || Status==EFI_END_OF_FILE)
+    Status = CpioWalkDone(Walker) ? EFI_SUCCESS : EFI_VOLUME_CORRUPTED;
+
+CLEANUP:
+  libboot_unload(context);
+
+  return Status;
+}
+
 EFI_STATUS
 LoaderBootFromFile (
   IN EFI_FILE_PROTOCOL  *File,
@@ -777,12 +1710,15 @@ LoaderBootFromFile (
   custom_init_context(&context);
 
   // identify
+  BootProfileStart();
+  BootProfileMark(LOADER_BOOT_PHASE_IDENTIFY);
   INTN rc = libboot_identify_file(File, &context);
   if(rc) goto CLEANUP;
 
-  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LastBootEntry);
+  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LOADER_RAMDISK_UNKNOWN, LastBootEntry);
 
 CLEANUP:
+  BootProfileStop();
   libboot_free_context(&context);
 
   return Status;
@@ -805,12 +1741,15 @@ LoaderBootFromBuffer (
   custom_init_context(&context);
 
   // identify
+  BootProfileStart();
+  BootProfileMark(LOADER_BOOT_PHASE_IDENTIFY);
   INTN rc = libboot_identify_memory(Buffer, Size, &context);
   if(rc) goto CLEANUP;
 
-  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LastBootEntry);
+  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LOADER_RAMDISK_UNKNOWN, LastBootEntry);
 
 CLEANUP:
+  BootProfileStop();
   libboot_free_context(&context);
 
   return Status;
@@ -832,12 +1771,15 @@ LoaderBootFromBlockIo (
   custom_init_context(&context);
 
   // identify
+  BootProfileStart();
+  BootProfileMark(LOADER_BOOT_PHASE_IDENTIFY);
   INTN rc = libboot_identify_blockio(BlockIo, &context);
   if(rc) goto CLEANUP;
 
-  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LastBootEntry);
+  Status = LoaderBootContext(&context, mbhandle, DisablePatching, IsRecovery, LOADER_RAMDISK_UNKNOWN, LastBootEntry);
 
 CLEANUP:
+  BootProfileStop();
   libboot_free_context(&context);
 
   return Status;
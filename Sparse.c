@@ -0,0 +1,279 @@
+#include "EFIDroidUi.h"
+
+#define SPARSE_STATE_FILE_HEADER   0
+#define SPARSE_STATE_CHUNK_HEADER  1
+#define SPARSE_STATE_CHUNK_DATA    2
+#define SPARSE_STATE_CHUNK_VALUE   3
+#define SPARSE_STATE_DONE          4
+
+BOOLEAN
+SparseIsImage (
+  IN CONST VOID *Data,
+  IN UINTN      Size
+)
+{
+  CONST SPARSE_HEADER *Header = Data;
+
+  if (Size < sizeof(*Header))
+    return FALSE;
+
+  return Header->Magic == SPARSE_HEADER_MAGIC;
+}
+
+VOID
+SparseInit (
+  OUT SPARSE_PARSER *Parser,
+  IN  SPARSE_WRITE  Write,
+  IN  SPARSE_FILL   Fill,
+  IN  SPARSE_SKIP   Skip,
+  IN  VOID          *Context
+)
+{
+  ZeroMem(Parser, sizeof(*Parser));
+  Parser->Write = Write;
+  Parser->Fill = Fill;
+  Parser->Skip = Skip;
+  Parser->Context = Context;
+
+  Parser->State = SPARSE_STATE_FILE_HEADER;
+  Parser->BufferSize = sizeof(SPARSE_HEADER);
+}
+
+STATIC
+BOOLEAN
+SparseCollect (
+  IN     SPARSE_PARSER *Parser,
+  IN OUT UINT8         **Data,
+  IN OUT UINTN         *Size
+)
+{
+  UINTN Len;
+
+  Len = MIN(*Size, Parser->BufferSize - Parser->BufferUsed);
+  CopyMem(Parser->Buffer + Parser->BufferUsed, *Data, Len);
+  Parser->BufferUsed += Len;
+  *Data += Len;
+  *Size -= Len;
+
+  if (Parser->BufferUsed < Parser->BufferSize)
+    return FALSE;
+
+  Parser->BufferUsed = 0;
+  return TRUE;
+}
+
+STATIC
+VOID
+SparseNextChunk (
+  IN SPARSE_PARSER *Parser
+)
+{
+  Parser->ChunkIndex++;
+
+  if (Parser->ChunkIndex < Parser->Header.TotalChunks) {
+    Parser->State = SPARSE_STATE_CHUNK_HEADER;
+    Parser->BufferSize = sizeof(SPARSE_CHUNK_HEADER);
+  }
+  else {
+    Parser->State = SPARSE_STATE_DONE;
+  }
+}
+
+STATIC
+EFI_STATUS
+SparseParseFileHeader (
+  IN SPARSE_PARSER *Parser
+)
+{
+  SPARSE_HEADER *Header = &Parser->Header;
+
+  CopyMem(Header, Parser->Buffer, sizeof(*Header));
+
+  if (Header->Magic != SPARSE_HEADER_MAGIC || Header->MajorVersion != 1)
+    return EFI_UNSUPPORTED;
+  if (Header->FileHeaderSize < sizeof(SPARSE_HEADER) || Header->ChunkHeaderSize < sizeof(SPARSE_CHUNK_HEADER))
+    return EFI_INVALID_PARAMETER;
+  if (Header->BlockSize == 0 || (Header->BlockSize % 4) != 0)
+    return EFI_INVALID_PARAMETER;
+
+  DEBUG((EFI_D_INFO, "sparse: %u blocks of %u bytes in %u chunks\n",
+    Header->TotalBlocks, Header->BlockSize, Header->TotalChunks));
+
+  Parser->InputSkip = Header->FileHeaderSize - sizeof(SPARSE_HEADER);
+  Parser->ChunkIndex = 0;
+
+  if (Header->TotalChunks == 0) {
+    Parser->State = SPARSE_STATE_DONE;
+  }
+  else {
+    Parser->State = SPARSE_STATE_CHUNK_HEADER;
+    Parser->BufferSize = sizeof(SPARSE_CHUNK_HEADER);
+  }
+
+  return EFI_SUCCESS;
+}
+
+STATIC
+EFI_STATUS
+SparseParseChunkHeader (
+  IN SPARSE_PARSER *Parser
+)
+{
+  SPARSE_CHUNK_HEADER Chunk;
+  UINT64              OutputSize;
+  UINT64              HeaderSize;
+  EFI_STATUS          Status;
+
+  CopyMem(&Chunk, Parser->Buffer, sizeof(Chunk));
+
+  HeaderSize = Parser->Header.ChunkHeaderSize;
+  OutputSize = MultU64x32(Chunk.ChunkSize, Parser->Header.BlockSize);
+
+  if (Parser->OutputBlocks + Chunk.ChunkSize > Parser->Header.TotalBlocks)
+    return EFI_INVALID_PARAMETER;
+  Parser->OutputBlocks += Chunk.ChunkSize;
+
+  Parser->InputSkip = HeaderSize - sizeof(SPARSE_CHUNK_HEADER);
+  Parser->ChunkType = Chunk.ChunkType;
+
+  switch (Chunk.ChunkType) {
+    case CHUNK_TYPE_RAW:
+      if (Chunk.TotalSize != HeaderSize + OutputSize)
+        return EFI_INVALID_PARAMETER;
+
+      Parser->ChunkDataLeft = OutputSize;
+      Parser->State = SPARSE_STATE_CHUNK_DATA;
+      if (OutputSize == 0)
+        SparseNextChunk(Parser);
+      break;
+
+    case CHUNK_TYPE_FILL:
+      if (Chunk.TotalSize != HeaderSize + sizeof(UINT32))
+        return EFI_INVALID_PARAMETER;
+
+      Parser->ChunkFillSize = OutputSize;
+      Parser->State = SPARSE_STATE_CHUNK_VALUE;
+      Parser->BufferSize = sizeof(UINT32);
+      break;
+
+    case CHUNK_TYPE_DONT_CARE:
+      if (Chunk.TotalSize != HeaderSize)
+        return EFI_INVALID_PARAMETER;
+
+      Status = Parser->Skip(Parser->Context, OutputSize);
+      if (EFI_ERROR(Status))
+        return Status;
+
+      SparseNextChunk(Parser);
+      break;
+
+    case CHUNK_TYPE_CRC32:
+      if (Chunk.TotalSize != HeaderSize + sizeof(UINT32))
+        return EFI_INVALID_PARAMETER;
+
+      Parser->ChunkFillSize = 0;
+      Parser->State = SPARSE_STATE_CHUNK_VALUE;
+      Parser->BufferSize = sizeof(UINT32);
+      break;
+
+    default:
+      DEBUG((EFI_D_ERROR, "sparse: unknown chunk type 0x%04x\n", Chunk.ChunkType));
+      return EFI_UNSUPPORTED;
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SparseFeed (
+  IN SPARSE_PARSER *Parser,
+  IN VOID          *Data,
+  IN UINTN         Size
+)
+{
+  UINT8      *Ptr = Data;
+  UINTN      Len;
+  UINT32     Value;
+  EFI_STATUS Status;
+
+  while (Size > 0) {
+    // skip unknown header extensions
+    if (Parser->InputSkip) {
+      Len = (UINTN)MIN((UINT64)Size, Parser->InputSkip);
+      Parser->InputSkip -= Len;
+      Ptr += Len;
+      Size -= Len;
+      continue;
+    }
+
+    switch (Parser->State) {
+      case SPARSE_STATE_FILE_HEADER:
+        if (!SparseCollect(Parser, &Ptr, &Size))
+          break;
+
+        Status = SparseParseFileHeader(Parser);
+        if (EFI_ERROR(Status))
+          return Status;
+        break;
+
+      case SPARSE_STATE_CHUNK_HEADER:
+        if (!SparseCollect(Parser, &Ptr, &Size))
+          break;
+
+        Status = SparseParseChunkHeader(Parser);
+        if (EFI_ERROR(Status))
+          return Status;
+        break;
+
+      case SPARSE_STATE_CHUNK_DATA:
+        Len = (UINTN)MIN((UINT64)Size, Parser->ChunkDataLeft);
+        Status = Parser->Write(Parser->Context, Ptr, Len);
+        if (EFI_ERROR(Status))
+          return Status;
+
+        Parser->ChunkDataLeft -= Len;
+        Ptr += Len;
+        Size -= Len;
+
+        if (Parser->ChunkDataLeft == 0)
+          SparseNextChunk(Parser);
+        break;
+
+      case SPARSE_STATE_CHUNK_VALUE:
+        if (!SparseCollect(Parser, &Ptr, &Size))
+          break;
+
+        CopyMem(&Value, Parser->Buffer, sizeof(Value));
+
+        // the checksum of CRC32 chunks isn't verified
+        if (Parser->ChunkType == CHUNK_TYPE_FILL) {
+          Status = Parser->Fill(Parser->Context, Value, Parser->ChunkFillSize);
+          if (EFI_ERROR(Status))
+            return Status;
+        }
+
+        SparseNextChunk(Parser);
+        break;
+
+      default:
+        // ignore trailing data
+        Size = 0;
+        break;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS
+SparseFinish (
+  IN SPARSE_PARSER *Parser
+)
+{
+  if (Parser->State != SPARSE_STATE_DONE) {
+    DEBUG((EFI_D_ERROR, "sparse: image truncated at chunk %u/%u\n", Parser->ChunkIndex, Parser->Header.TotalChunks));
+    return EFI_END_OF_FILE;
+  }
+
+  return EFI_SUCCESS;
+}